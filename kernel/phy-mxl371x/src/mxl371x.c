@@ -14,9 +14,24 @@
 #include <linux/of_net.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/ctype.h>
 #include <linux/ethtool.h>
 #include <linux/hwmon.h>
 #include <linux/random.h>
+#include <linux/average.h>
+#include <linux/ktime.h>
+#include <linux/ratelimit.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/elf.h>
+#include <linux/sort.h>
+#include <linux/unaligned.h>
+#ifdef CONFIG_MXL371X_FW_DIGEST
+#include <crypto/hash.h>
+#include <crypto/sha2.h>
+#endif
 
 /* MaxLinear OUI and PHY IDs */
 #define MXL371X_OUI			0x0243E000
@@ -29,6 +44,17 @@
 #define MXL371X_FW_LEUCADIA		"ccpu.elf.leucadia"
 #define MXL371X_FW_CARDIFF		"ccpu.elf.cardiff"
 #define MXL371X_MAX_FW_SIZE		(4 * 1024 * 1024)
+#define MXL371X_FW_NAME_LEN		64
+#define MXL371X_FW_HASH_CHUNK		4096
+#define MXL371X_FW_MAX_SEGS		16
+
+/* Firmware version record (VERSION section of the image) */
+#define MXL371X_FW_VERSION_SECTION	"VERSION"
+#define MXL371X_FW_VERSION_ADDR		0x0c6fffcc
+#define MXL371X_FW_VERSION_STR_OFF	0x1c
+#define MXL371X_FW_VERSION_STR_LEN	24
+#define MXL371X_FW_VERSION_REC_LEN	(MXL371X_FW_VERSION_STR_OFF + \
+					 MXL371X_FW_VERSION_STR_LEN)
 
 /* MoCA SoC Chip Types */
 #define MXL_MOCA_SOC_TYPE_LEUCADIA	0
@@ -59,6 +85,8 @@
 
 /* Firmware Status */
 #define MXL371X_FW_BASE_ADDR		0x00000000
+/* Where the CCPU starts after the SoC reset is released */
+#define MXL371X_CCPU_RESET_VECTOR	0x0c400000
 #define MXL371X_FW_STATUS_REG		0x08200100
 #define MXL371X_FW_LOADED		BIT(0)
 #define MXL371X_FW_RUNNING		BIT(1)
@@ -75,6 +103,15 @@
 #define MXL371X_SGMII_MODE_HSGMII	0x03
 #define MXL371X_SGMII_MODE_1000BASE_X	0x04
 
+/* PHY rate above which a MoCA 2.5 network needs HSGMII (Mbps) */
+#define MXL371X_HSGMII_MIN_RATE		1000
+
+/* Signal quality, PHY rate as a share of the best rate of the version */
+#define MXL371X_SQI_MAX			7
+#define MXL371X_MOCA_1_1_MAX_RATE	300
+#define MXL371X_MOCA_2_0_MAX_RATE	1400
+#define MXL371X_MOCA_2_5_MAX_RATE	3500
+
 /* MoCA Statistics Registers */
 #define MOCA_STATS_BASE			0x0c000000
 #define MOCA_STATS_TX_TOTAL_PKTS	(MOCA_STATS_BASE + 0x00)
@@ -108,6 +145,9 @@
 #define MOCA_VER_2_0			0x20
 #define MOCA_VER_2_5			0x25
 
+/* Node IDs of a MoCA network */
+#define MOCA_MAX_NODES			16
+
 /* MoCA Network States */
 #define MOCA_NET_STATE_IDLE		0
 #define MOCA_NET_STATE_SEARCHING	1
@@ -121,8 +161,189 @@
 #define MOCA_SECURITY_STATUS_REG	0x0c100200
 #define MOCA_SECURITY_ENABLED		BIT(0)
 
+/* Background polling */
+#define MXL371X_POLL_INTERVAL		HZ
+#define MXL371X_TEMP_POLL_INTERVAL	10	/* in polls */
+
+/* Carrier hold-down and flap dampening */
+#define MXL371X_LINK_DELAY_MAX_MS	60000
+#define MXL371X_FLAP_PENALTY		1000
+#define MXL371X_FLAP_PENALTY_MAX	12000
+#define MXL371X_FLAP_SUPPRESS		3000
+#define MXL371X_FLAP_REUSE		750
+#define MXL371X_FLAP_HALF_LIFE		(15 * HZ)
+
+/* Link quality alerts, sent as uevents */
+#define MXL371X_ALERT_INTERVAL		(10 * HZ)
+
+enum mxl371x_alert {
+	MXL371X_ALERT_RATE_DROP,
+	MXL371X_ALERT_RX_ERRORS,
+	MXL371X_ALERT_TEMP,
+	MXL371X_ALERT_NODE_LEAVE,
+	MXL371X_ALERT_NUM,
+};
+
+static const char * const mxl371x_alert_names[MXL371X_ALERT_NUM] = {
+	[MXL371X_ALERT_RATE_DROP] = "rate_drop",
+	[MXL371X_ALERT_RX_ERRORS] = "rx_errors",
+	[MXL371X_ALERT_TEMP] = "temperature",
+	[MXL371X_ALERT_NODE_LEAVE] = "node_leave",
+};
+
+#ifdef CONFIG_MXL371X_HISTORY
+/* Link history ring, one sample per poll (about 2h16m) */
+#define MXL371X_HISTORY_LEN		8192
+#define MXL371X_HISTORY_MAGIC		0x484c584d	/* "MXLH" */
+#define MXL371X_HISTORY_VERSION		1
+
+#define MXL371X_HIST_F_CARRIER		BIT(0)
+#define MXL371X_HIST_F_TEMP_VALID	BIT(1)
+
+/*
+ * Layout of the debugfs "history" file, in host byte order: the header
+ * followed by MXL371X_HISTORY_LEN samples. Sample (head - 1) % len is the
+ * newest one; head counts every sample ever written.
+ */
+struct mxl371x_history_hdr {
+	u32 magic;
+	u16 version;
+	u16 sample_size;
+	u32 nr_samples;
+	u32 head;
+} __packed;
+
+struct mxl371x_history_sample {
+	u64 timestamp_ms;	/* CLOCK_REALTIME */
+	u32 tx_bytes;		/* Deltas since the previous sample */
+	u32 rx_bytes;
+	u16 rx_errors;		/* Saturating */
+	u16 tx_dropped;		/* Saturating */
+	u16 phy_rate;
+	u16 active_nodes;
+	s16 temp;		/* 0.1 degrees Celsius */
+	u8 link_status;
+	u8 flags;
+} __packed;
+
+struct mxl371x_history {
+	struct mxl371x_history_hdr hdr;
+	struct mxl371x_history_sample samples[];
+} __packed;
+
+#define MXL371X_HISTORY_SIZE						\
+	(sizeof(struct mxl371x_history) +				\
+	 MXL371X_HISTORY_LEN * sizeof(struct mxl371x_history_sample))
+#endif /* CONFIG_MXL371X_HISTORY */
+
+/* Topology event log */
+enum mxl371x_event_type {
+	MXL371X_EVENT_NODES,
+	MXL371X_EVENT_NC,
+	MXL371X_EVENT_NODE_ID,
+	MXL371X_EVENT_LOF,
+};
+
+#ifdef CONFIG_MXL371X_DEBUGFS
+#define MXL371X_EVENT_LOG_LEN		256
+
+struct mxl371x_event {
+	u64 timestamp_ms;	/* CLOCK_REALTIME */
+	u32 old;
+	u32 new;
+	u8 type;
+};
+
+/* Longest throughput measurement run through debugfs */
+#define MXL371X_THROUGHPUT_MAX_SECS	60
+#endif /* CONFIG_MXL371X_DEBUGFS */
+
+/* Throughput averages, in bytes per second */
+DECLARE_EWMA(mxl371x_rate, 2, 8)
+
+/* File-backed part of a PT_LOAD segment of the firmware ELF */
+struct mxl371x_fw_seg {
+	u32 addr;
+	u32 offset;
+	u32 size;
+};
+
+struct mxl371x_fw_image {
+	u32 entry;
+	unsigned int nr_segs;
+	struct mxl371x_fw_seg segs[MXL371X_FW_MAX_SEGS];
+};
+
+/*
+ * Device lifecycle. Changes happen with priv->lock held, entry points that
+ * touch the chip check the state under the same lock. Lockless readers use
+ * READ_ONCE() for a cheap early exit.
+ */
+enum mxl371x_state {
+	MXL371X_STATE_PROBING,		/* no firmware checked yet */
+	MXL371X_STATE_LOADING,		/* SoC in reset, firmware uploading */
+	MXL371X_STATE_RUNNING,		/* firmware up, chip usable */
+	MXL371X_STATE_ERROR,		/* no usable firmware */
+	MXL371X_STATE_RECOVERING,	/* re-checking firmware after resume */
+	MXL371X_STATE_SUSPENDED,
+};
+
+static const char * const mxl371x_state_names[] = {
+	[MXL371X_STATE_PROBING] = "probing",
+	[MXL371X_STATE_LOADING] = "loading",
+	[MXL371X_STATE_RUNNING] = "running",
+	[MXL371X_STATE_ERROR] = "error",
+	[MXL371X_STATE_RECOVERING] = "recovering",
+	[MXL371X_STATE_SUSPENDED] = "suspended",
+};
+
+/* Values exported through moca_metrics and ethtool */
+enum mxl371x_metric_id {
+	MXL371X_M_TX_PACKETS,
+	MXL371X_M_TX_BYTES,
+	MXL371X_M_TX_DROPPED,
+	MXL371X_M_TX_BROADCAST,
+	MXL371X_M_TX_MULTICAST,
+	MXL371X_M_RX_PACKETS,
+	MXL371X_M_RX_BYTES,
+	MXL371X_M_RX_DROPPED,
+	MXL371X_M_RX_ERRORS,
+	MXL371X_M_TX_RATE,
+	MXL371X_M_RX_RATE,
+	MXL371X_M_LINK_UP,
+	MXL371X_M_LINK_FLAPS,
+	MXL371X_M_PHY_RATE,
+	MXL371X_M_MOCA_VERSION,
+	MXL371X_M_NODE_ID,
+	MXL371X_M_NC_NODE_ID,
+	MXL371X_M_LOF,
+	MXL371X_M_ACTIVE_NODES,
+	MXL371X_M_TEMPERATURE,
+	MXL371X_M_MDIO_XFERS,
+	MXL371X_M_FW_REQUEST,
+	MXL371X_M_FW_UPLOAD,
+	MXL371X_M_FW_START,
+	MXL371X_M_FW_SKIPPED,
+	MXL371X_M_NUM,
+};
+
+/* Metrics as of the last poll, published for lockless readers */
+struct mxl371x_metrics_snap {
+	s64 val[MXL371X_M_NUM];
+	bool temp_valid;
+	char fw_version[MXL371X_FW_VERSION_STR_LEN + 1];
+	char fw_image_version[MXL371X_FW_VERSION_STR_LEN + 1];
+};
+
 struct mxl371x_priv {
-	bool fw_loaded;
+	struct phy_device *phydev;
+	/* Serialises chip access sequences and state changes */
+	struct mutex lock;
+	enum mxl371x_state state;
+	bool fw_segment_load;
+	bool fw_sparse_upload;
+	bool fw_digest_required;
+	bool auto_host_if;
 	u32 soc_chip_type;
 	u32 device_id;
 	u32 revision_id;
@@ -136,7 +357,11 @@ struct mxl371x_priv {
 	u32 active_nodes;
 	bool security_enabled;
 	const char *fw_name;
+	char fw_name_buf[MXL371X_FW_NAME_LEN];
 	char soc_version[64];
+	char fw_version[MXL371X_FW_VERSION_STR_LEN + 1];
+	char fw_image_version[MXL371X_FW_VERSION_STR_LEN + 1];
+	u32 fw_version_addr;
 
 	/* Statistics */
 	struct {
@@ -151,10 +376,135 @@ struct mxl371x_priv {
 		u64 rx_errors;
 	} stats;
 
+	/* Derived from the previous poll */
+	u64 last_tx_bytes;
+	u64 last_rx_bytes;
+	unsigned long last_poll;
+	struct ewma_mxl371x_rate tx_rate;
+	struct ewma_mxl371x_rate rx_rate;
+
+	/* Signal quality index, 0..MXL371X_SQI_MAX */
+	int sqi;
+
+	/* Cached chip temperature (millidegrees Celsius) */
+	int temp;
+	bool temp_valid;
+	unsigned int temp_countdown;
+
+	/* Carrier reported to phylib, see mxl371x_link_dampen() */
+	struct {
+		bool carrier;
+		bool raw;
+		unsigned long raw_since;
+		u32 up_delay_ms;
+		u32 down_delay_ms;
+		bool dampening;
+		bool suppressed;
+		u32 penalty;
+		unsigned long penalty_stamp;
+		u64 flaps;
+	} link;
+
+	/* Alert thresholds (0 disables) and evaluation state */
+	struct {
+		u32 rate_drop_pct;
+		u32 rx_errors_ps;
+		int temp;
+		u32 rate_ref;
+		u32 active_nodes;
+		u32 left_pending;	/* departures not reported yet */
+		u64 rx_errors;
+		unsigned long rx_errors_stamp;
+		unsigned long raised;
+		struct ratelimit_state rs[MXL371X_ALERT_NUM];
+	} alert;
+
+#ifdef CONFIG_MXL371X_HISTORY
+	/* Link history ring and the counters of its newest sample */
+	struct mxl371x_history *hist;
+	struct {
+		u64 tx_bytes;
+		u64 rx_bytes;
+		u64 rx_errors;
+		u64 tx_dropped;
+	} hist_last;
+#endif
+
+	/* Network Coordinator history, time as NC in ms per node ID */
+	struct {
+		bool valid;
+		u32 node;
+		u64 since;		/* jiffies64, an NC may serve for months */
+		u64 handoffs;
+		u64 tenure_ms[MOCA_MAX_NODES];
+	} nc;
+
+#ifdef CONFIG_MXL371X_DEBUGFS
+	/* Topology changes, newest at (event_head - 1) % len */
+	spinlock_t event_lock;
+	u32 event_head;
+	struct mxl371x_event events[MXL371X_EVENT_LOG_LEN];
+
+	/* Result of the last throughput measurement, under priv->lock */
+	struct {
+		u32 ms;
+		u32 tx_mbps;
+		u32 rx_mbps;
+		u64 tx_packets;
+		u64 rx_packets;
+		u64 tx_dropped;
+		u64 rx_dropped;
+		u64 rx_errors;
+	} tput;
+
+	struct dentry *debugfs;
+#endif
+
+	/* Firmware boot timeline of the last cold boot (milliseconds) */
+	struct {
+		u32 request_ms;
+		u32 upload_ms;
+		u32 start_ms;
+		u32 skipped_words;
+	} boot;
+
+	/* Outcome of the last firmware swap requested through sysfs */
+	struct {
+		char name[MXL371X_FW_NAME_LEN];
+		int result;
+		u32 ms;
+	} fw_swap;
+
+	/* MDIO transactions issued for indirect memory access */
+	atomic64_t mdio_xfers;
+
+	/* Written with priv->lock held, read without it */
+	seqcount_mutex_t metrics_seq;
+	struct mxl371x_metrics_snap metrics;
+
 	struct delayed_work stats_poll;
+#ifdef CONFIG_MXL371X_HWMON
 	struct device *hwmon_dev;
+#endif
 };
 
+#ifdef CONFIG_MXL371X_DEBUGFS
+static struct dentry *mxl371x_debugfs_root;
+#endif
+
+static void mxl371x_set_state(struct mxl371x_priv *priv,
+			      enum mxl371x_state state)
+{
+	lockdep_assert_held(&priv->lock);
+
+	if (priv->state == state)
+		return;
+
+	dev_dbg(&priv->phydev->mdio.dev, "State %s -> %s\n",
+		mxl371x_state_names[priv->state], mxl371x_state_names[state]);
+	WRITE_ONCE(priv->state, state);
+}
+
 static int mxl371x_read_page(struct phy_device *phydev)
 {
 	return __phy_read(phydev, MXL371X_PAGE_SELECT);
@@ -167,6 +517,7 @@ static int mxl371x_write_page(struct phy_device *phydev, int page)
 
 static int mxl371x_read_mem32(struct phy_device *phydev, u32 addr, u32 *val)
 {
+	struct mxl371x_priv *priv = phydev->priv;
 	int ret;
 	u16 data_hi, data_lo;
 
@@ -189,6 +540,7 @@ static int mxl371x_read_mem32(struct phy_device *phydev, u32 addr, u32 *val)
 	data_lo = ret;
 
 	*val = ((u32)data_hi << 16) | data_lo;
+	atomic64_add(4, &priv->mdio_xfers);
 	return 0;
 }
 
@@ -211,6 +563,7 @@ static int mxl371x_read_mem64(struct phy_device *phydev, u32 addr, u64 *val)
 
 static int mxl371x_write_mem32(struct phy_device *phydev, u32 addr, u32 val)
 {
+	struct mxl371x_priv *priv = phydev->priv;
 	int ret;
 
 	ret = phy_write(phydev, MXL371X_MDIO_ADDR_REG, (addr >> 16) & 0xffff);
@@ -225,7 +578,12 @@ static int mxl371x_write_mem32(struct phy_device *phydev, u32 addr, u32 val)
 	if (ret < 0)
 		return ret;
 
-	return phy_write(phydev, MXL371X_MDIO_DATA_REG + 1, val & 0xffff);
+	ret = phy_write(phydev, MXL371X_MDIO_DATA_REG + 1, val & 0xffff);
+	if (ret < 0)
+		return ret;
+
+	atomic64_add(4, &priv->mdio_xfers);
+	return 0;
 }
 
 /* Temperature sensor reading */
@@ -326,11 +684,66 @@ static void mxl371x_update_stats(struct phy_device *phydev)
 		dev_warn_ratelimited(dev, "Failed to update MoCA statistics\n");
 }
 
+#ifdef CONFIG_MXL371X_DEBUGFS
+static void mxl371x_log_event(struct mxl371x_priv *priv,
+			      enum mxl371x_event_type type, u32 old, u32 new)
+{
+	struct mxl371x_event *ev;
+
+	if (old == new)
+		return;
+
+	spin_lock(&priv->event_lock);
+	ev = &priv->events[priv->event_head++ % MXL371X_EVENT_LOG_LEN];
+	ev->timestamp_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+	ev->type = type;
+	ev->old = old;
+	ev->new = new;
+	spin_unlock(&priv->event_lock);
+}
+#else
+static void mxl371x_log_event(struct mxl371x_priv *priv,
+			      enum mxl371x_event_type type, u32 old, u32 new)
+{
+}
+#endif
+
+/*
+ * Account the time the current NC has served and count handoffs, a change
+ * of NC while the link stays up. Re-forming the network after a link loss
+ * is not a handoff.
+ */
+static void mxl371x_update_nc(struct mxl371x_priv *priv)
+{
+	u64 now = get_jiffies_64();
+	bool up = priv->link_status == MOCA_LINK_UP &&
+		  priv->nc_node_id < MOCA_MAX_NODES;
+
+	if (priv->nc.valid && (!up || priv->nc_node_id != priv->nc.node)) {
+		priv->nc.tenure_ms[priv->nc.node] +=
+			jiffies64_to_msecs(now - priv->nc.since);
+		priv->nc.valid = false;
+
+		if (up)
+			priv->nc.handoffs++;
+	}
+
+	if (up && !priv->nc.valid) {
+		priv->nc.node = priv->nc_node_id;
+		priv->nc.since = now;
+		priv->nc.valid = true;
+	}
+}
+
 /* Update MoCA status */
 static void mxl371x_read_moca_status(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 	struct device *dev = &phydev->mdio.dev;
+	u32 active_nodes = priv->active_nodes;
+	u32 nc_node_id = priv->nc_node_id;
+	u32 node_id = priv->node_id;
+	u32 lof = priv->lof;
 	u32 val;
 	int ret = 0;
 
@@ -381,43 +794,367 @@ static void mxl371x_read_moca_status(struct phy_device *phydev)
 
 	if (ret < 0)
 		dev_warn_ratelimited(dev, "Failed to read MoCA status\n");
+
+	mxl371x_update_nc(priv);
+
+	mxl371x_log_event(priv, MXL371X_EVENT_NODES, active_nodes,
+			  priv->active_nodes);
+	mxl371x_log_event(priv, MXL371X_EVENT_NC, nc_node_id, priv->nc_node_id);
+	mxl371x_log_event(priv, MXL371X_EVENT_NODE_ID, node_id, priv->node_id);
+	mxl371x_log_event(priv, MXL371X_EVENT_LOF, lof, priv->lof);
+}
+
+/* Fold the counter deltas since the previous poll into the rate averages */
+static void mxl371x_update_rates(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	unsigned long now = jiffies;
+	unsigned int ms;
+
+	if (priv->last_poll) {
+		ms = jiffies_to_msecs(now - priv->last_poll);
+		/* Counters restart from zero after a firmware reload */
+		if (ms && priv->stats.tx_bytes >= priv->last_tx_bytes &&
+		    priv->stats.rx_bytes >= priv->last_rx_bytes) {
+			ewma_mxl371x_rate_add(&priv->tx_rate,
+				div_u64((priv->stats.tx_bytes -
+					 priv->last_tx_bytes) * MSEC_PER_SEC, ms));
+			ewma_mxl371x_rate_add(&priv->rx_rate,
+				div_u64((priv->stats.rx_bytes -
+					 priv->last_rx_bytes) * MSEC_PER_SEC, ms));
+		}
+	}
+
+	priv->last_tx_bytes = priv->stats.tx_bytes;
+	priv->last_rx_bytes = priv->stats.rx_bytes;
+	priv->last_poll = now;
+}
+
+/*
+ * There is no SNR readout, but the PHY rate is what the bit loading of the
+ * link achieved and so follows the channel quality. Scale it against the
+ * best rate of the MoCA version onto the SQI range.
+ */
+static void mxl371x_update_sqi(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	u32 max_rate;
+	int sqi = 0;
+
+	if (priv->moca_version >= MOCA_VER_2_5)
+		max_rate = MXL371X_MOCA_2_5_MAX_RATE;
+	else if (priv->moca_version >= MOCA_VER_2_0)
+		max_rate = MXL371X_MOCA_2_0_MAX_RATE;
+	else
+		max_rate = MXL371X_MOCA_1_1_MAX_RATE;
+
+	if (priv->link_status == MOCA_LINK_UP)
+		sqi = min_t(u32, priv->phy_rate * (MXL371X_SQI_MAX + 1) /
+				 max_rate, MXL371X_SQI_MAX);
+
+	WRITE_ONCE(priv->sqi, sqi);
+}
+
+/* Refresh the cached temperature every MXL371X_TEMP_POLL_INTERVAL polls */
+static void mxl371x_update_temp(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	u32 t0, t1;
+	int temp;
+
+	if (priv->temp_countdown--)
+		return;
+
+	priv->temp_countdown = MXL371X_TEMP_POLL_INTERVAL - 1;
+
+	if (mxl371x_read_temp_raw(phydev, &t0, &t1) < 0)
+		return;
+
+	temp = mxl371x_calc_temp(t0, t1);
+	if (temp == -EINVAL)
+		return;
+
+	priv->temp = temp;
+	priv->temp_valid = true;
+}
+
+/* Send an alert uevent. Returns false if the ratelimit dropped it */
+static bool mxl371x_alert(struct phy_device *phydev, enum mxl371x_alert id,
+			  s64 value)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	char event[32], val[32];
+	char *envp[] = { event, val, NULL };
+
+	if (!__ratelimit(&priv->alert.rs[id]))
+		return false;
+
+	snprintf(event, sizeof(event), "MOCA_ALERT=%s", mxl371x_alert_names[id]);
+	snprintf(val, sizeof(val), "MOCA_VALUE=%lld", value);
+
+	dev_info(dev, "MoCA alert %s (%lld)\n", mxl371x_alert_names[id], value);
+	kobject_uevent_env(&dev->kobj, KOBJ_CHANGE, envp);
+	return true;
+}
+
+/*
+ * Edge-triggered check: alert once when the condition starts to hold. An
+ * edge the ratelimit dropped is retried on the next poll.
+ */
+static void mxl371x_alert_check(struct phy_device *phydev,
+				enum mxl371x_alert id, bool cond, s64 value)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+
+	if (!cond) {
+		__clear_bit(id, &priv->alert.raised);
+		return;
+	}
+
+	if (!test_bit(id, &priv->alert.raised) &&
+	    mxl371x_alert(phydev, id, value))
+		__set_bit(id, &priv->alert.raised);
+}
+
+/* Evaluate the alert thresholds against the state cached by this poll */
+static void mxl371x_update_alerts(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	u32 pct = READ_ONCE(priv->alert.rate_drop_pct);
+	u32 errs_ps = READ_ONCE(priv->alert.rx_errors_ps);
+	int temp = READ_ONCE(priv->alert.temp);
+	unsigned long now = jiffies;
+	u32 left, rate = 0;
+	unsigned int ms;
+
+	/* PHY rate drop against the best rate seen on this link */
+	if (priv->link_status != MOCA_LINK_UP) {
+		priv->alert.rate_ref = 0;
+	} else if (priv->phy_rate >= priv->alert.rate_ref) {
+		priv->alert.rate_ref = priv->phy_rate;
+	} else if (pct && (u64)(priv->alert.rate_ref - priv->phy_rate) * 100 >
+			  (u64)priv->alert.rate_ref * pct &&
+		   mxl371x_alert(phydev, MXL371X_ALERT_RATE_DROP,
+				 priv->phy_rate)) {
+		priv->alert.rate_ref = priv->phy_rate;
+	}
+
+	/*
+	 * RX error rate since the previous poll. The counter restarts from
+	 * zero after a firmware reload, so skip the sample that spans one.
+	 */
+	ms = jiffies_to_msecs(now - priv->alert.rx_errors_stamp);
+	if (priv->stats.rx_errors >= priv->alert.rx_errors) {
+		if (priv->alert.rx_errors_stamp && ms)
+			rate = div_u64((priv->stats.rx_errors -
+					priv->alert.rx_errors) * MSEC_PER_SEC,
+				       ms);
+		mxl371x_alert_check(phydev, MXL371X_ALERT_RX_ERRORS,
+				    errs_ps && rate > errs_ps, rate);
+	}
+	priv->alert.rx_errors = priv->stats.rx_errors;
+	priv->alert.rx_errors_stamp = now;
+
+	mxl371x_alert_check(phydev, MXL371X_ALERT_TEMP,
+			    temp && priv->temp_valid && priv->temp > temp,
+			    priv->temp);
+
+	/*
+	 * Nodes that dropped out of the network. Departures the ratelimit
+	 * held back go out with the next alert it lets through.
+	 */
+	left = priv->alert.active_nodes & ~priv->active_nodes;
+	priv->alert.active_nodes = priv->active_nodes;
+	priv->alert.left_pending |= left;
+	if (priv->alert.left_pending &&
+	    mxl371x_alert(phydev, MXL371X_ALERT_NODE_LEAVE,
+			  priv->alert.left_pending))
+		priv->alert.left_pending = 0;
+}
+
+#ifdef CONFIG_MXL371X_HISTORY
+/* Counter delta for a history sample, tolerating counter resets */
+static u32 mxl371x_hist_delta(u64 cur, u64 *last, u32 max)
+{
+	u64 delta = cur >= *last ? cur - *last : cur;
+
+	*last = cur;
+	return min_t(u64, delta, max);
+}
+
+/* Append the state cached by this poll to the history ring */
+static void mxl371x_update_history(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct mxl371x_history *hist = priv->hist;
+	struct mxl371x_history_sample *smp;
+	u32 head;
+
+	if (!hist)
+		return;
+
+	head = hist->hdr.head;
+	smp = &hist->samples[head % MXL371X_HISTORY_LEN];
+
+	/* The first sample has no predecessor to diff against */
+	if (!head) {
+		priv->hist_last.tx_bytes = priv->stats.tx_bytes;
+		priv->hist_last.rx_bytes = priv->stats.rx_bytes;
+		priv->hist_last.rx_errors = priv->stats.rx_errors;
+		priv->hist_last.tx_dropped = priv->stats.tx_dropped;
+	}
+
+	smp->timestamp_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+	smp->tx_bytes = mxl371x_hist_delta(priv->stats.tx_bytes,
+					   &priv->hist_last.tx_bytes, U32_MAX);
+	smp->rx_bytes = mxl371x_hist_delta(priv->stats.rx_bytes,
+					   &priv->hist_last.rx_bytes, U32_MAX);
+	smp->rx_errors = mxl371x_hist_delta(priv->stats.rx_errors,
+					    &priv->hist_last.rx_errors, U16_MAX);
+	smp->tx_dropped = mxl371x_hist_delta(priv->stats.tx_dropped,
+					     &priv->hist_last.tx_dropped,
+					     U16_MAX);
+	smp->phy_rate = min_t(u32, priv->phy_rate, U16_MAX);
+	smp->active_nodes = priv->active_nodes;
+	smp->temp = priv->temp / 100;
+	smp->link_status = priv->link_status;
+	smp->flags = (priv->link.carrier ? MXL371X_HIST_F_CARRIER : 0) |
+		     (priv->temp_valid ? MXL371X_HIST_F_TEMP_VALID : 0);
+
+	hist->hdr.head = head + 1;
+}
+#else
+static void mxl371x_update_history(struct phy_device *phydev)
+{
+}
+#endif
+
+/*
+ * Publish the values cached by the chip users for readers that must not
+ * wait for priv->lock, which is held across a firmware upload. Called with
+ * priv->lock held after every update; the write section only copies memory.
+ */
+static void mxl371x_metrics_publish(struct mxl371x_priv *priv)
+{
+	s64 *val = priv->metrics.val;
+
+	write_seqcount_begin(&priv->metrics_seq);
+
+	val[MXL371X_M_TX_PACKETS] = priv->stats.tx_packets;
+	val[MXL371X_M_TX_BYTES] = priv->stats.tx_bytes;
+	val[MXL371X_M_TX_DROPPED] = priv->stats.tx_dropped;
+	val[MXL371X_M_TX_BROADCAST] = priv->stats.tx_broadcast;
+	val[MXL371X_M_TX_MULTICAST] = priv->stats.tx_multicast;
+	val[MXL371X_M_RX_PACKETS] = priv->stats.rx_packets;
+	val[MXL371X_M_RX_BYTES] = priv->stats.rx_bytes;
+	val[MXL371X_M_RX_DROPPED] = priv->stats.rx_dropped;
+	val[MXL371X_M_RX_ERRORS] = priv->stats.rx_errors;
+	val[MXL371X_M_TX_RATE] = ewma_mxl371x_rate_read(&priv->tx_rate);
+	val[MXL371X_M_RX_RATE] = ewma_mxl371x_rate_read(&priv->rx_rate);
+	val[MXL371X_M_LINK_UP] = priv->link_status == MOCA_LINK_UP;
+	val[MXL371X_M_LINK_FLAPS] = priv->link.flaps;
+	val[MXL371X_M_PHY_RATE] = priv->phy_rate;
+	val[MXL371X_M_MOCA_VERSION] = (priv->moca_version >> 4) * 10 +
+				      (priv->moca_version & 0xf);
+	val[MXL371X_M_NODE_ID] = priv->node_id;
+	val[MXL371X_M_NC_NODE_ID] = priv->nc_node_id;
+	val[MXL371X_M_LOF] = priv->lof;
+	val[MXL371X_M_ACTIVE_NODES] = hweight32(priv->active_nodes);
+	val[MXL371X_M_TEMPERATURE] = priv->temp;
+	val[MXL371X_M_MDIO_XFERS] = atomic64_read(&priv->mdio_xfers);
+	val[MXL371X_M_FW_REQUEST] = priv->boot.request_ms;
+	val[MXL371X_M_FW_UPLOAD] = priv->boot.upload_ms;
+	val[MXL371X_M_FW_START] = priv->boot.start_ms;
+	val[MXL371X_M_FW_SKIPPED] = priv->boot.skipped_words;
+	priv->metrics.temp_valid = priv->temp_valid;
+	strscpy(priv->metrics.fw_version, priv->fw_version,
+		sizeof(priv->metrics.fw_version));
+	strscpy(priv->metrics.fw_image_version, priv->fw_image_version,
+		sizeof(priv->metrics.fw_image_version));
+
+	write_seqcount_end(&priv->metrics_seq);
+}
+
+/* Copy the last published metrics, all from the same poll */
+static void mxl371x_metrics_read(struct mxl371x_priv *priv,
+				 struct mxl371x_metrics_snap *snap)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&priv->metrics_seq);
+		*snap = priv->metrics;
+	} while (read_seqcount_retry(&priv->metrics_seq, seq));
 }
 
 static void mxl371x_stats_poll_work(struct work_struct *work)
 {
 	struct mxl371x_priv *priv = container_of(work, struct mxl371x_priv,
 						 stats_poll.work);
-	struct phy_device *phydev = container_of((void *)priv,
-						  struct phy_device, priv);
+	struct phy_device *phydev = priv->phydev;
 
-	if (priv->fw_loaded && phydev->attached_dev) {
+	/* Do not wait out a firmware load, just try again next time */
+	if (READ_ONCE(priv->state) != MXL371X_STATE_RUNNING)
+		goto out;
+
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_RUNNING && phydev->attached_dev) {
 		mxl371x_update_stats(phydev);
+		mxl371x_update_rates(phydev);
 		mxl371x_read_moca_status(phydev);
+		mxl371x_update_sqi(phydev);
+		mxl371x_update_temp(phydev);
+		mxl371x_update_alerts(phydev);
+		mxl371x_update_history(phydev);
+		mxl371x_metrics_publish(priv);
 	}
+	mutex_unlock(&priv->lock);
 
-	schedule_delayed_work(&priv->stats_poll, HZ);
+out:
+	schedule_delayed_work(&priv->stats_poll, MXL371X_POLL_INTERVAL);
 }
 
 /* Standard ethtool PHY statistics */
 static void mxl371x_get_phy_stats(struct phy_device *phydev,
 				  struct ethtool_eth_phy_stats *phy_stats,
 				  struct ethtool_phy_stats *phydev_stats)
+{
+	struct mxl371x_metrics_snap snap;
+
+	mxl371x_metrics_read(phydev->priv, &snap);
+
+	phydev_stats->rx_packets = snap.val[MXL371X_M_RX_PACKETS];
+	phydev_stats->rx_bytes = snap.val[MXL371X_M_RX_BYTES];
+	phydev_stats->rx_errors = snap.val[MXL371X_M_RX_ERRORS];
+	phydev_stats->tx_packets = snap.val[MXL371X_M_TX_PACKETS];
+	phydev_stats->tx_bytes = snap.val[MXL371X_M_TX_BYTES];
+	phydev_stats->tx_errors = snap.val[MXL371X_M_TX_DROPPED];
+}
+
+/* Signal quality from the poller cache */
+static int mxl371x_get_sqi(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 
-	phydev_stats->rx_packets = priv->stats.rx_packets;
-	phydev_stats->rx_bytes = priv->stats.rx_bytes;
-	phydev_stats->rx_errors = priv->stats.rx_errors;
-	phydev_stats->tx_packets = priv->stats.tx_packets;
-	phydev_stats->tx_bytes = priv->stats.tx_bytes;
-	phydev_stats->tx_errors = priv->stats.tx_dropped;
+	if (READ_ONCE(priv->state) != MXL371X_STATE_RUNNING)
+		return -ENODATA;
+
+	return READ_ONCE(priv->sqi);
+}
+
+static int mxl371x_get_sqi_max(struct phy_device *phydev)
+{
+	return MXL371X_SQI_MAX;
 }
 
+#ifdef CONFIG_MXL371X_HWMON
 /* HWMON temperature sensor support */
 static int mxl371x_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
 			      u32 attr, int channel, long *val)
 {
 	struct phy_device *phydev = dev_get_drvdata(dev);
+	struct mxl371x_priv *priv = phydev->priv;
 	u32 t0, t1;
 	int ret, temp;
 
@@ -426,7 +1163,12 @@ static int mxl371x_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
 
 	switch (attr) {
 	case hwmon_temp_input:
-		ret = mxl371x_read_temp_raw(phydev, &t0, &t1);
+		mutex_lock(&priv->lock);
+		if (priv->state == MXL371X_STATE_RUNNING)
+			ret = mxl371x_read_temp_raw(phydev, &t0, &t1);
+		else
+			ret = -ENODATA;
+		mutex_unlock(&priv->lock);
 		if (ret < 0)
 			return ret;
 
@@ -490,81 +1232,413 @@ static int mxl371x_hwmon_init(struct phy_device *phydev)
 	priv->hwmon_dev = hwmon_dev;
 	return 0;
 }
+#else
+static int mxl371x_hwmon_init(struct phy_device *phydev)
+{
+	return 0;
+}
+#endif
 
-/* Check if firmware is already running (warm boot) */
-static int mxl371x_check_firmware_running(struct phy_device *phydev)
+#ifdef CONFIG_MXL371X_HISTORY
+/*
+ * debugfs: binary link history. The ring is copied under priv->lock when
+ * the file is opened, so reads in any chunk size see one consistent state.
+ */
+static int mxl371x_history_open(struct inode *inode, struct file *file)
 {
-	struct device *dev = &phydev->mdio.dev;
-	u32 fw_status;
-	int ret;
+	struct mxl371x_priv *priv = inode->i_private;
+	void *snap;
 
-	ret = mxl371x_read_mem32(phydev, MXL371X_FW_STATUS_REG, &fw_status);
-	if (ret < 0) {
-		dev_warn(dev, "Cannot read firmware status: %d\n", ret);
-		return 0;
-	}
+	snap = vmalloc(MXL371X_HISTORY_SIZE);
+	if (!snap)
+		return -ENOMEM;
 
-	if (fw_status & MXL371X_FW_RUNNING) {
-		dev_info(dev, "Firmware already running (warm boot detected)\n");
-		return 1;
-	}
+	mutex_lock(&priv->lock);
+	memcpy(snap, priv->hist, MXL371X_HISTORY_SIZE);
+	mutex_unlock(&priv->lock);
 
-	if (fw_status & MXL371X_FW_ERROR) {
-		dev_warn(dev, "Firmware in error state, will reload\n");
-		return 0;
-	}
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t mxl371x_history_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	return simple_read_from_buffer(buf, count, ppos, file->private_data,
+				       MXL371X_HISTORY_SIZE);
+}
 
+static int mxl371x_history_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
 	return 0;
 }
 
-/* MoCA GUID management */
-static int mxl371x_set_default_guid(struct phy_device *phydev)
+static const struct file_operations mxl371x_history_fops = {
+	.owner = THIS_MODULE,
+	.open = mxl371x_history_open,
+	.read = mxl371x_history_read,
+	.release = mxl371x_history_release,
+	.llseek = default_llseek,
+};
+
+static void mxl371x_history_free(void *data)
+{
+	vfree(data);
+}
+
+static int mxl371x_history_init(struct phy_device *phydev)
 {
+	struct mxl371x_priv *priv = phydev->priv;
 	struct device *dev = &phydev->mdio.dev;
-	u32 mac_hi, mac_lo;
-	u8 mac[ETH_ALEN];
+	struct mxl371x_history *hist;
 	int ret;
 
-	/* 1. Check if already set in hardware (non-zero) */
-	ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_HI, &mac_hi);
-	if (ret == 0 && mac_hi != 0) {
-		ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_LO, &mac_lo);
-		if (ret == 0 && (mac_hi != 0 || mac_lo != 0)) {
-			mac[0] = (mac_hi >> 24) & 0xff;
-			mac[1] = (mac_hi >> 16) & 0xff;
-			mac[2] = (mac_hi >> 8) & 0xff;
-			mac[3] = (mac_hi >> 0) & 0xff;
-			mac[4] = (mac_lo >> 24) & 0xff;
-			mac[5] = (mac_lo >> 16) & 0xff;
+	hist = vzalloc(MXL371X_HISTORY_SIZE);
+	if (!hist)
+		return -ENOMEM;
 
-			dev_info(dev, "Using existing MoCA GUID: %pM\n", mac);
-			return 0;
-		}
-	}
+	ret = devm_add_action_or_reset(dev, mxl371x_history_free, hist);
+	if (ret < 0)
+		return ret;
 
-	/* 2. Try to get from device tree */
-	if (dev->of_node) {
-		/* of_get_mac_address returns 0 on success */
-		if (of_get_mac_address(dev->of_node, mac) == 0) {
-			dev_info(dev, "Using MoCA GUID from device tree: %pM\n", mac);
-			goto set_guid;
+	hist->hdr.magic = MXL371X_HISTORY_MAGIC;
+	hist->hdr.version = MXL371X_HISTORY_VERSION;
+	hist->hdr.sample_size = sizeof(struct mxl371x_history_sample);
+	hist->hdr.nr_samples = MXL371X_HISTORY_LEN;
+
+	priv->hist = hist;
+	return 0;
+}
+#else
+static int mxl371x_history_init(struct phy_device *phydev)
+{
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_MXL371X_DEBUGFS
+/* debugfs: topology event log, oldest first */
+static int mxl371x_events_show(struct seq_file *s, void *data)
+{
+	struct mxl371x_priv *priv = s->private;
+	struct mxl371x_event *ev;
+	u32 i, first, ms;
+	u64 ts;
+
+	spin_lock(&priv->event_lock);
+
+	first = priv->event_head > MXL371X_EVENT_LOG_LEN ?
+		priv->event_head - MXL371X_EVENT_LOG_LEN : 0;
+
+	for (i = first; i != priv->event_head; i++) {
+		ev = &priv->events[i % MXL371X_EVENT_LOG_LEN];
+		ts = div_u64_rem(ev->timestamp_ms, MSEC_PER_SEC, &ms);
+
+		seq_printf(s, "%llu.%03u ", ts, ms);
+
+		switch (ev->type) {
+		case MXL371X_EVENT_NODES:
+			seq_printf(s, "nodes 0x%08x -> 0x%08x joined 0x%08x left 0x%08x\n",
+				   ev->old, ev->new, ev->new & ~ev->old,
+				   ev->old & ~ev->new);
+			break;
+		case MXL371X_EVENT_NC:
+			seq_printf(s, "nc %u -> %u\n", ev->old, ev->new);
+			break;
+		case MXL371X_EVENT_NODE_ID:
+			seq_printf(s, "node_id %u -> %u\n", ev->old, ev->new);
+			break;
+		case MXL371X_EVENT_LOF:
+			seq_printf(s, "lof %u -> %u\n", ev->old, ev->new);
+			break;
 		}
 	}
 
-	/* 3. Try to derive from attached netdev (if available) */
-	if (phydev->attached_dev && 
-	    !is_zero_ether_addr(phydev->attached_dev->dev_addr)) {
-		ether_addr_copy(mac, phydev->attached_dev->dev_addr);
-		/* Modify to distinguish from host MAC */
-		mac[0] |= 0x02;  /* Set locally administered bit */
-		mac[5] ^= 0x01;  /* Flip last bit */
-		dev_info(dev, "Using MoCA GUID derived from netdev: %pM\n", mac);
-		goto set_guid;
-	}
+	spin_unlock(&priv->event_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mxl371x_events);
 
-	/* 4. Generate using MaxLinear OUI + random bytes */
-	/* MaxLinear OUI: 00:24:3E, with locally administered bit set */
-	mac[0] = 0x02;  /* Locally administered (bit 1 set) */
+/*
+ * debugfs: datapath throughput over a timed window, taken from the chip
+ * counters. Traffic comes from the outside (iperf, a loopback test); write
+ * the window length in seconds, read the result.
+ */
+static int mxl371x_throughput_run(struct mxl371x_priv *priv, unsigned int secs)
+{
+	struct phy_device *phydev = priv->phydev;
+	typeof(priv->stats) before, after;
+	ktime_t start;
+	u32 ms;
+	int ret = 0;
+
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_RUNNING) {
+		mxl371x_update_stats(phydev);
+		before = priv->stats;
+		start = ktime_get();
+	} else {
+		ret = -EBUSY;
+	}
+	mutex_unlock(&priv->lock);
+	if (ret < 0)
+		return ret;
+
+	if (msleep_interruptible(secs * MSEC_PER_SEC))
+		return -EINTR;
+
+	mutex_lock(&priv->lock);
+	if (priv->state != MXL371X_STATE_RUNNING) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	mxl371x_update_stats(phydev);
+	after = priv->stats;
+	ms = max_t(u32, ktime_ms_delta(ktime_get(), start), 1);
+
+	/* Counters restart when the firmware is reloaded */
+	if (after.tx_packets < before.tx_packets ||
+	    after.rx_packets < before.rx_packets) {
+		ret = -EAGAIN;
+		goto unlock;
+	}
+
+	priv->tput.ms = ms;
+	priv->tput.tx_mbps = div_u64((after.tx_bytes - before.tx_bytes) * 8,
+				     ms * 1000);
+	priv->tput.rx_mbps = div_u64((after.rx_bytes - before.rx_bytes) * 8,
+				     ms * 1000);
+	priv->tput.tx_packets = after.tx_packets - before.tx_packets;
+	priv->tput.rx_packets = after.rx_packets - before.rx_packets;
+	priv->tput.tx_dropped = after.tx_dropped - before.tx_dropped;
+	priv->tput.rx_dropped = after.rx_dropped - before.rx_dropped;
+	priv->tput.rx_errors = after.rx_errors - before.rx_errors;
+
+	dev_info(&phydev->mdio.dev,
+		 "Throughput over %u ms: TX %u Mbps, RX %u Mbps, %llu dropped, %llu errors\n",
+		 ms, priv->tput.tx_mbps, priv->tput.rx_mbps,
+		 priv->tput.tx_dropped + priv->tput.rx_dropped,
+		 priv->tput.rx_errors);
+unlock:
+	mutex_unlock(&priv->lock);
+	return ret;
+}
+
+static int mxl371x_throughput_show(struct seq_file *s, void *data)
+{
+	struct mxl371x_priv *priv = s->private;
+
+	mutex_lock(&priv->lock);
+	if (priv->tput.ms)
+		seq_printf(s, "duration_ms %u\n"
+			   "tx_mbps %u\nrx_mbps %u\n"
+			   "tx_packets %llu\nrx_packets %llu\n"
+			   "tx_dropped %llu\nrx_dropped %llu\n"
+			   "rx_errors %llu\n",
+			   priv->tput.ms, priv->tput.tx_mbps, priv->tput.rx_mbps,
+			   priv->tput.tx_packets, priv->tput.rx_packets,
+			   priv->tput.tx_dropped, priv->tput.rx_dropped,
+			   priv->tput.rx_errors);
+	mutex_unlock(&priv->lock);
+	return 0;
+}
+
+static int mxl371x_throughput_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mxl371x_throughput_show, inode->i_private);
+}
+
+static ssize_t mxl371x_throughput_write(struct file *file,
+					const char __user *ubuf,
+					size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	unsigned int secs;
+	int ret;
+
+	ret = kstrtouint_from_user(ubuf, count, 0, &secs);
+	if (ret)
+		return ret;
+
+	if (!secs || secs > MXL371X_THROUGHPUT_MAX_SECS)
+		return -EINVAL;
+
+	ret = mxl371x_throughput_run(s->private, secs);
+	return ret < 0 ? ret : count;
+}
+
+static const struct file_operations mxl371x_throughput_fops = {
+	.owner = THIS_MODULE,
+	.open = mxl371x_throughput_open,
+	.read = seq_read,
+	.write = mxl371x_throughput_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void mxl371x_debugfs_init(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+
+	spin_lock_init(&priv->event_lock);
+	priv->debugfs = debugfs_create_dir(dev_name(&phydev->mdio.dev),
+					   mxl371x_debugfs_root);
+
+#ifdef CONFIG_MXL371X_HISTORY
+	if (priv->hist)
+		debugfs_create_file("history", 0400, priv->debugfs, priv,
+				    &mxl371x_history_fops);
+#endif
+
+	debugfs_create_file("events", 0400, priv->debugfs, priv,
+			    &mxl371x_events_fops);
+	debugfs_create_file("throughput", 0600, priv->debugfs, priv,
+			    &mxl371x_throughput_fops);
+}
+
+static void mxl371x_debugfs_remove(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+
+	debugfs_remove_recursive(priv->debugfs);
+}
+
+static void __init mxl371x_debugfs_register(void)
+{
+	mxl371x_debugfs_root = debugfs_create_dir("mxl371x", NULL);
+}
+
+static void mxl371x_debugfs_unregister(void)
+{
+	debugfs_remove_recursive(mxl371x_debugfs_root);
+}
+#else
+static void mxl371x_debugfs_init(struct phy_device *phydev)
+{
+}
+
+static void mxl371x_debugfs_remove(struct phy_device *phydev)
+{
+}
+
+static void __init mxl371x_debugfs_register(void)
+{
+}
+
+static void mxl371x_debugfs_unregister(void)
+{
+}
+#endif /* CONFIG_MXL371X_DEBUGFS */
+
+/* Compare the version record in chip memory against the one of the image */
+static bool mxl371x_fw_version_matches(struct phy_device *phydev,
+				       const u8 *rec, u32 addr)
+{
+	u8 buf[MXL371X_FW_VERSION_REC_LEN];
+	u32 val;
+	int i;
+
+	/* Words hold the image bytes in upload order, LSB first */
+	for (i = 0; i < MXL371X_FW_VERSION_REC_LEN; i += 4) {
+		if (mxl371x_read_mem32(phydev, addr + i, &val) < 0)
+			return false;
+
+		put_unaligned_le32(val, &buf[i]);
+	}
+
+	return !memcmp(buf, rec, sizeof(buf));
+}
+
+/*
+ * Check if firmware is already running (warm boot). If @rec is given, the
+ * running firmware must also carry that version record at @addr.
+ */
+static int mxl371x_check_firmware_running(struct phy_device *phydev,
+					  const u8 *rec, u32 addr)
+{
+	struct device *dev = &phydev->mdio.dev;
+	u32 fw_status;
+	int ret;
+
+	ret = mxl371x_read_mem32(phydev, MXL371X_FW_STATUS_REG, &fw_status);
+	if (ret < 0) {
+		dev_warn(dev, "Cannot read firmware status: %d\n", ret);
+		return 0;
+	}
+
+	if (fw_status & MXL371X_FW_RUNNING) {
+		if (!rec) {
+			dev_info(dev, "Firmware already running (warm boot detected)\n");
+			return 1;
+		}
+
+		if (mxl371x_fw_version_matches(phydev, rec, addr)) {
+			dev_info(dev, "Firmware already running (warm boot detected, same image)\n");
+			return 1;
+		}
+
+		dev_info(dev, "Running firmware is not this image, will reload\n");
+		return 0;
+	}
+
+	if (fw_status & MXL371X_FW_ERROR) {
+		dev_warn(dev, "Firmware in error state, will reload\n");
+		return 0;
+	}
+
+	return 0;
+}
+
+/* MoCA GUID management */
+static int mxl371x_set_default_guid(struct phy_device *phydev)
+{
+	struct device *dev = &phydev->mdio.dev;
+	u32 mac_hi, mac_lo;
+	u8 mac[ETH_ALEN];
+	int ret;
+
+	/* 1. Check if already set in hardware (non-zero) */
+	ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_HI, &mac_hi);
+	if (ret == 0 && mac_hi != 0) {
+		ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_LO, &mac_lo);
+		if (ret == 0 && (mac_hi != 0 || mac_lo != 0)) {
+			mac[0] = (mac_hi >> 24) & 0xff;
+			mac[1] = (mac_hi >> 16) & 0xff;
+			mac[2] = (mac_hi >> 8) & 0xff;
+			mac[3] = (mac_hi >> 0) & 0xff;
+			mac[4] = (mac_lo >> 24) & 0xff;
+			mac[5] = (mac_lo >> 16) & 0xff;
+
+			dev_info(dev, "Using existing MoCA GUID: %pM\n", mac);
+			return 0;
+		}
+	}
+
+	/* 2. Try to get from device tree */
+	if (dev->of_node) {
+		/* of_get_mac_address returns 0 on success */
+		if (of_get_mac_address(dev->of_node, mac) == 0) {
+			dev_info(dev, "Using MoCA GUID from device tree: %pM\n", mac);
+			goto set_guid;
+		}
+	}
+
+	/* 3. Try to derive from attached netdev (if available) */
+	if (phydev->attached_dev && 
+	    !is_zero_ether_addr(phydev->attached_dev->dev_addr)) {
+		ether_addr_copy(mac, phydev->attached_dev->dev_addr);
+		/* Modify to distinguish from host MAC */
+		mac[0] |= 0x02;  /* Set locally administered bit */
+		mac[5] ^= 0x01;  /* Flip last bit */
+		dev_info(dev, "Using MoCA GUID derived from netdev: %pM\n", mac);
+		goto set_guid;
+	}
+
+	/* 4. Generate using MaxLinear OUI + random bytes */
+	/* MaxLinear OUI: 00:24:3E, with locally administered bit set */
+	mac[0] = 0x02;  /* Locally administered (bit 1 set) */
 	mac[1] = 0x24;  /* MaxLinear OUI byte 2 */
 	mac[2] = 0x3e;  /* MaxLinear OUI byte 3 */
 
@@ -589,6 +1663,17 @@ set_guid:
 }
 
 /* Sysfs attributes */
+static ssize_t moca_state_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%s\n",
+		       mxl371x_state_names[READ_ONCE(priv->state)]);
+}
+static DEVICE_ATTR_RO(moca_state);
+
 static ssize_t moca_link_status_show(struct device *dev,
 				     struct device_attribute *attr, char *buf)
 {
@@ -653,6 +1738,41 @@ static ssize_t moca_nc_node_id_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(moca_nc_node_id);
 
+static ssize_t moca_nc_handoffs_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%llu\n", READ_ONCE(priv->nc.handoffs));
+}
+static DEVICE_ATTR_RO(moca_nc_handoffs);
+
+/* Seconds each node has served as NC, one "<node> <seconds>" per line */
+static ssize_t moca_nc_tenure_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	u64 tenure_ms;
+	int i, len = 0;
+
+	mutex_lock(&priv->lock);
+	for (i = 0; i < MOCA_MAX_NODES; i++) {
+		tenure_ms = priv->nc.tenure_ms[i];
+		if (priv->nc.valid && priv->nc.node == i)
+			tenure_ms += jiffies64_to_msecs(get_jiffies_64() -
+							priv->nc.since);
+		if (tenure_ms)
+			len += sysfs_emit_at(buf, len, "%d %llu\n", i,
+					     div_u64(tenure_ms, MSEC_PER_SEC));
+	}
+	mutex_unlock(&priv->lock);
+
+	return len;
+}
+static DEVICE_ATTR_RO(moca_nc_tenure);
+
 static ssize_t moca_lof_show(struct device *dev,
 			     struct device_attribute *attr, char *buf)
 {
@@ -725,22 +1845,52 @@ static ssize_t moca_fw_version_show(struct device *dev,
 	struct phy_device *phydev = to_phy_device(dev);
 	struct mxl371x_priv *priv = phydev->priv;
 
-	return sprintf(buf, "%s\n", priv->soc_version);
+	return sprintf(buf, "%s\n", priv->fw_version);
 }
 static DEVICE_ATTR_RO(moca_fw_version);
 
+static ssize_t moca_fw_image_version_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%s\n", priv->fw_image_version[0] ?
+		       priv->fw_image_version : "unknown");
+}
+static DEVICE_ATTR_RO(moca_fw_image_version);
+
+static ssize_t moca_soc_version_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%s\n", priv->soc_version);
+}
+static DEVICE_ATTR_RO(moca_soc_version);
+
 /* MoCA GUID - read/write */
 static ssize_t moca_guid_show(struct device *dev,
 			      struct device_attribute *attr, char *buf)
 {
 	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
 	u32 mac_hi, mac_lo;
 	u8 mac[ETH_ALEN];
-
-	if (mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_HI, &mac_hi) < 0)
-		return -EIO;
-	if (mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_LO, &mac_lo) < 0)
-		return -EIO;
+	int ret = -EBUSY;
+
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_RUNNING) {
+		ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_HI, &mac_hi);
+		if (ret == 0)
+			ret = mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_LO,
+						 &mac_lo);
+	}
+	mutex_unlock(&priv->lock);
+	if (ret < 0)
+		return ret;
 
 	mac[0] = (mac_hi >> 24) & 0xff;
 	mac[1] = (mac_hi >> 16) & 0xff;
@@ -757,8 +1907,10 @@ static ssize_t moca_guid_store(struct device *dev,
 			       const char *buf, size_t count)
 {
 	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
 	u8 mac[ETH_ALEN];
 	u32 mac_hi, mac_lo;
+	int ret = -EBUSY;
 
 	if (!mac_pton(buf, mac))
 		return -EINVAL;
@@ -770,97 +1922,993 @@ static ssize_t moca_guid_store(struct device *dev,
 	mac_hi = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
 	mac_lo = (mac[4] << 24) | (mac[5] << 16);
 
-	if (mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_HI, mac_hi) < 0)
-		return -EIO;
-	if (mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_LO, mac_lo) < 0)
-		return -EIO;
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_RUNNING) {
+		ret = mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_HI, mac_hi);
+		if (ret == 0)
+			ret = mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_LO,
+						  mac_lo);
+	}
+	mutex_unlock(&priv->lock);
+	if (ret < 0)
+		return ret;
 
 	dev_info(dev, "MoCA GUID set to %pM\n", mac);
 	return count;
 }
 static DEVICE_ATTR_RW(moca_guid);
 
-static struct attribute *mxl371x_attrs[] = {
-	&dev_attr_moca_link_status.attr,
-	&dev_attr_moca_version.attr,
-	&dev_attr_moca_phy_rate.attr,
-	&dev_attr_moca_node_id.attr,
-	&dev_attr_moca_nc_node_id.attr,
-	&dev_attr_moca_lof.attr,
-	&dev_attr_moca_network_state.attr,
-	&dev_attr_moca_active_nodes.attr,
-	&dev_attr_moca_security_enabled.attr,
-	&dev_attr_moca_chip_type.attr,
-	&dev_attr_moca_fw_version.attr,
-	&dev_attr_moca_guid.attr,
-	NULL,
-};
-
-static const struct attribute_group mxl371x_attr_group = {
-	.attrs = mxl371x_attrs,
-};
-
-static int mxl371x_get_device_info(struct phy_device *phydev)
+/* Carrier hold-down and dampening - read/write */
+static ssize_t mxl371x_store_delay(const char *buf, size_t count,
+				   u32 *delay_ms)
 {
-	struct mxl371x_priv *priv = phydev->priv;
-	struct device *dev = &phydev->mdio.dev;
 	u32 val;
 	int ret;
 
-	ret = mxl371x_read_mem32(phydev, SRE_PRODUCT_FAMILY_ID, &val);
+	ret = kstrtou32(buf, 0, &val);
 	if (ret < 0)
 		return ret;
 
-	dev_info(dev, "Product Family ID: 0x%08x\n", val);
-
-	ret = mxl371x_read_mem32(phydev, SRE_DEVICE_ID, &val);
-	if (ret < 0)
-		return ret;
+	if (val > MXL371X_LINK_DELAY_MAX_MS)
+		return -ERANGE;
 
-	priv->device_id = val & 0xffff;
-	priv->revision_id = (val >> SRE_REVISION_ID_OFFSET) & 0xffff;
+	WRITE_ONCE(*delay_ms, val);
+	return count;
+}
 
-	if (priv->device_id == 0x3710 || priv->device_id == 0x3711) {
-		priv->soc_chip_type = MXL_MOCA_SOC_TYPE_LEUCADIA;
-		priv->fw_name = MXL371X_FW_LEUCADIA;
-	} else {
-		priv->soc_chip_type = MXL_MOCA_SOC_TYPE_CARDIFF;
-		priv->fw_name = MXL371X_FW_CARDIFF;
-	}
+static ssize_t moca_link_up_delay_ms_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
 
-	snprintf(priv->soc_version, sizeof(priv->soc_version),
-		 "%s Device 0x%04x Rev 0x%04x",
-		 priv->soc_chip_type == MXL_MOCA_SOC_TYPE_LEUCADIA ?
-		 "Leucadia" : "Cardiff", priv->device_id, priv->revision_id);
+	return sprintf(buf, "%u\n", priv->link.up_delay_ms);
+}
 
-	dev_info(dev, "%s\n", priv->soc_version);
+static ssize_t moca_link_up_delay_ms_store(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
 
-	return 0;
+	return mxl371x_store_delay(buf, count, &priv->link.up_delay_ms);
 }
+static DEVICE_ATTR_RW(moca_link_up_delay_ms);
 
-static int mxl371x_load_firmware(struct phy_device *phydev)
+static ssize_t moca_link_down_delay_ms_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%u\n", priv->link.down_delay_ms);
+}
+
+static ssize_t moca_link_down_delay_ms_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return mxl371x_store_delay(buf, count, &priv->link.down_delay_ms);
+}
+static DEVICE_ATTR_RW(moca_link_down_delay_ms);
+
+static ssize_t moca_link_dampening_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%u\n", priv->link.dampening ? 1 : 0);
+}
+
+static ssize_t moca_link_dampening_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret < 0)
+		return ret;
+
+	WRITE_ONCE(priv->link.dampening, val);
+	return count;
+}
+static DEVICE_ATTR_RW(moca_link_dampening);
+
+static ssize_t moca_link_flaps_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%llu\n", priv->link.flaps);
+}
+static DEVICE_ATTR_RO(moca_link_flaps);
+
+static ssize_t moca_link_suppressed_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%u\n", priv->link.suppressed ? 1 : 0);
+}
+static DEVICE_ATTR_RO(moca_link_suppressed);
+
+/* Alert thresholds - read/write, 0 disables */
+static ssize_t moca_alert_rate_drop_pct_show(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%u\n", priv->alert.rate_drop_pct);
+}
+
+static ssize_t moca_alert_rate_drop_pct_store(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	if (val > 100)
+		return -ERANGE;
+
+	WRITE_ONCE(priv->alert.rate_drop_pct, val);
+	return count;
+}
+static DEVICE_ATTR_RW(moca_alert_rate_drop_pct);
+
+static ssize_t moca_alert_rx_errors_ps_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%u\n", priv->alert.rx_errors_ps);
+}
+
+static ssize_t moca_alert_rx_errors_ps_store(struct device *dev,
+					     struct device_attribute *attr,
+					     const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	WRITE_ONCE(priv->alert.rx_errors_ps, val);
+	return count;
+}
+static DEVICE_ATTR_RW(moca_alert_rx_errors_ps);
+
+static ssize_t moca_alert_temp_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	return sprintf(buf, "%d\n", priv->alert.temp);
+}
+
+static ssize_t moca_alert_temp_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	int val, ret;
+
+	ret = kstrtoint(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	WRITE_ONCE(priv->alert.temp, val);
+	return count;
+}
+static DEVICE_ATTR_RW(moca_alert_temp);
+
+/* OpenMetrics export of the published metrics, one snapshot per read */
+struct mxl371x_metric {
+	const char *desc;	/* TYPE line */
+	const char *sample;	/* Sample name up to the label value */
+};
+
+/*
+ * Everything but the label value and the sample value is built here. The
+ * whole export has to fit into one sysfs page, so there are no HELP lines;
+ * @_help only documents the metric.
+ */
+#define MXL371X_METRIC(_name, _type, _suffix, _help)			\
+	{								\
+		.desc = "# TYPE mxl371x_" _name " " _type "\n",		\
+		.sample = "mxl371x_" _name _suffix "{device=\"",	\
+	}
+#define MXL371X_COUNTER(_name, _help)					\
+	MXL371X_METRIC(_name, "counter", "_total", _help)
+#define MXL371X_GAUGE(_name, _help)					\
+	MXL371X_METRIC(_name, "gauge", "", _help)
+
+static const struct mxl371x_metric mxl371x_metrics[MXL371X_M_NUM] = {
+	[MXL371X_M_TX_PACKETS] = MXL371X_COUNTER("tx_packets", "Packets sent"),
+	[MXL371X_M_TX_BYTES] = MXL371X_COUNTER("tx_bytes", "Bytes sent"),
+	[MXL371X_M_TX_DROPPED] = MXL371X_COUNTER("tx_dropped", "TX drops"),
+	[MXL371X_M_TX_BROADCAST] = MXL371X_COUNTER("tx_broadcast",
+						  "Broadcasts sent"),
+	[MXL371X_M_TX_MULTICAST] = MXL371X_COUNTER("tx_multicast",
+						  "Multicasts sent"),
+	[MXL371X_M_RX_PACKETS] = MXL371X_COUNTER("rx_packets",
+						"Packets received"),
+	[MXL371X_M_RX_BYTES] = MXL371X_COUNTER("rx_bytes", "Bytes received"),
+	[MXL371X_M_RX_DROPPED] = MXL371X_COUNTER("rx_dropped", "RX drops"),
+	[MXL371X_M_RX_ERRORS] = MXL371X_COUNTER("rx_errors", "RX errors"),
+	[MXL371X_M_TX_RATE] = MXL371X_GAUGE("tx_bytes_per_second",
+					    "Average TX rate"),
+	[MXL371X_M_RX_RATE] = MXL371X_GAUGE("rx_bytes_per_second",
+					    "Average RX rate"),
+	[MXL371X_M_LINK_UP] = MXL371X_GAUGE("link_up", "MoCA link is up"),
+	[MXL371X_M_LINK_FLAPS] = MXL371X_COUNTER("link_flaps", "Link flaps"),
+	[MXL371X_M_PHY_RATE] = MXL371X_GAUGE("phy_rate_mbps", "PHY rate"),
+	[MXL371X_M_MOCA_VERSION] = MXL371X_GAUGE("moca_version",
+						"MoCA version x10"),
+	[MXL371X_M_NODE_ID] = MXL371X_GAUGE("node_id", "Own node ID"),
+	[MXL371X_M_NC_NODE_ID] = MXL371X_GAUGE("nc_node_id", "NC node ID"),
+	[MXL371X_M_LOF] = MXL371X_GAUGE("lof_mhz", "Last operating freq"),
+	[MXL371X_M_ACTIVE_NODES] = MXL371X_GAUGE("active_nodes",
+						"Nodes in network"),
+	[MXL371X_M_TEMPERATURE] = MXL371X_GAUGE("temperature_millicelsius",
+					       "Chip temperature"),
+	[MXL371X_M_MDIO_XFERS] = MXL371X_COUNTER("mdio_transactions",
+						"MDIO bus accesses"),
+	[MXL371X_M_FW_REQUEST] = MXL371X_GAUGE("fw_request_ms",
+					      "Boot: firmware read"),
+	[MXL371X_M_FW_UPLOAD] = MXL371X_GAUGE("fw_upload_ms",
+					     "Boot: firmware upload"),
+	[MXL371X_M_FW_START] = MXL371X_GAUGE("fw_start_ms",
+					    "Boot: firmware start"),
+	[MXL371X_M_FW_SKIPPED] = MXL371X_GAUGE("fw_skipped_words",
+					      "Boot: zero words skipped"),
+};
+
+/* Append to the metrics page, failing instead of truncating */
+static __printf(3, 4) int mxl371x_metrics_emit(char *buf, int *len,
+					       const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf(buf + *len, PAGE_SIZE - *len, fmt, args);
+	va_end(args);
+
+	if (n >= PAGE_SIZE - *len)
+		return -EFBIG;
+
+	*len += n;
+	return 0;
+}
+
+static ssize_t moca_metrics_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	const char *name = dev_name(dev);
+	struct mxl371x_metrics_snap snap;
+	int i, ret, len = 0;
+
+	mxl371x_metrics_read(priv, &snap);
+
+	for (i = 0; i < MXL371X_M_NUM; i++) {
+		if (i == MXL371X_M_TEMPERATURE && !snap.temp_valid)
+			continue;
+
+		ret = mxl371x_metrics_emit(buf, &len, "%s%s%s\"} %lld\n",
+					   mxl371x_metrics[i].desc,
+					   mxl371x_metrics[i].sample, name,
+					   snap.val[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* A truncated export would be invalid, so # EOF is written or none */
+	ret = mxl371x_metrics_emit(buf, &len,
+				   "# TYPE mxl371x_firmware info\n"
+				   "mxl371x_firmware_info{device=\"%s\",version=\"%s\",image=\"%s\"} 1\n"
+				   "# EOF\n",
+				   name, snap.fw_version, snap.fw_image_version);
+	if (ret < 0)
+		return ret;
+
+	return len;
+}
+static DEVICE_ATTR_RO(moca_metrics);
+
+/* ethtool --phy-statistics, taken from the same snapshot as the metrics */
+static const struct {
+	const char *name;
+	enum mxl371x_metric_id id;
+} mxl371x_ethtool_stats[] = {
+	{ "tx_packets", MXL371X_M_TX_PACKETS },
+	{ "tx_bytes", MXL371X_M_TX_BYTES },
+	{ "tx_dropped", MXL371X_M_TX_DROPPED },
+	{ "tx_broadcast", MXL371X_M_TX_BROADCAST },
+	{ "tx_multicast", MXL371X_M_TX_MULTICAST },
+	{ "rx_packets", MXL371X_M_RX_PACKETS },
+	{ "rx_bytes", MXL371X_M_RX_BYTES },
+	{ "rx_dropped", MXL371X_M_RX_DROPPED },
+	{ "rx_errors", MXL371X_M_RX_ERRORS },
+	{ "tx_bytes_per_second", MXL371X_M_TX_RATE },
+	{ "rx_bytes_per_second", MXL371X_M_RX_RATE },
+	{ "link_flaps", MXL371X_M_LINK_FLAPS },
+	{ "phy_rate_mbps", MXL371X_M_PHY_RATE },
+	{ "active_nodes", MXL371X_M_ACTIVE_NODES },
+	{ "mdio_transactions", MXL371X_M_MDIO_XFERS },
+};
+
+static int mxl371x_get_sset_count(struct phy_device *phydev)
+{
+	return ARRAY_SIZE(mxl371x_ethtool_stats);
+}
+
+static void mxl371x_get_strings(struct phy_device *phydev, u8 *data)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mxl371x_ethtool_stats); i++)
+		ethtool_puts(&data, mxl371x_ethtool_stats[i].name);
+}
+
+static void mxl371x_get_stats(struct phy_device *phydev,
+			      struct ethtool_stats *stats, u64 *data)
+{
+	struct mxl371x_metrics_snap snap;
+	int i;
+
+	mxl371x_metrics_read(phydev->priv, &snap);
+
+	for (i = 0; i < ARRAY_SIZE(mxl371x_ethtool_stats); i++)
+		data[i] = snap.val[mxl371x_ethtool_stats[i].id];
+}
+
+/* Standard link statistics, a flap is a loss of the MoCA link */
+static void mxl371x_get_link_stats(struct phy_device *phydev,
+				   struct ethtool_link_ext_stats *link_stats)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+
+	link_stats->link_down_events = READ_ONCE(priv->link.flaps);
+}
+
+static int mxl371x_get_device_info(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	u32 val;
+	int ret;
+
+	ret = mxl371x_read_mem32(phydev, SRE_PRODUCT_FAMILY_ID, &val);
+	if (ret < 0)
+		return ret;
+
+	dev_info(dev, "Product Family ID: 0x%08x\n", val);
+
+	ret = mxl371x_read_mem32(phydev, SRE_DEVICE_ID, &val);
+	if (ret < 0)
+		return ret;
+
+	priv->device_id = val & 0xffff;
+	priv->revision_id = (val >> SRE_REVISION_ID_OFFSET) & 0xffff;
+
+	if (priv->device_id == 0x3710 || priv->device_id == 0x3711) {
+		priv->soc_chip_type = MXL_MOCA_SOC_TYPE_LEUCADIA;
+		priv->fw_name = MXL371X_FW_LEUCADIA;
+	} else {
+		priv->soc_chip_type = MXL_MOCA_SOC_TYPE_CARDIFF;
+		priv->fw_name = MXL371X_FW_CARDIFF;
+	}
+
+	/* A firmware swapped in at runtime stays in use until unbind */
+	if (priv->fw_name_buf[0])
+		priv->fw_name = priv->fw_name_buf;
+
+	snprintf(priv->soc_version, sizeof(priv->soc_version),
+		 "%s Device 0x%04x Rev 0x%04x",
+		 priv->soc_chip_type == MXL_MOCA_SOC_TYPE_LEUCADIA ?
+		 "Leucadia" : "Cardiff", priv->device_id, priv->revision_id);
+
+	dev_info(dev, "%s\n", priv->soc_version);
+
+	return 0;
+}
+
+/*
+ * Copy a version string. Only [0-9A-Za-z._+-] is accepted, since the
+ * string ends up unescaped in the OpenMetrics label values.
+ */
+static bool mxl371x_copy_version(char *dst, const u8 *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && src[i]; i++) {
+		if (!isalnum(src[i]) && !strchr("._+-", src[i]))
+			break;
+		dst[i] = src[i];
+	}
+
+	if (!i || (i < len && src[i])) {
+		dst[0] = '\0';
+		return false;
+	}
+
+	dst[i] = '\0';
+	return true;
+}
+
+/*
+ * Get the firmware version string from the VERSION section of the image.
+ * @version and @addr are left empty if the image has no valid record.
+ */
+static int mxl371x_fw_image_version(const struct firmware *fw, char *version,
+				    u32 *addr, const u8 **rec)
+{
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)fw->data;
+	const Elf32_Shdr *shdr, *strtab;
+	u32 shoff, stroff, strsize, name, offset, size;
+	u16 shnum, shstrndx;
+	unsigned int i;
+
+	version[0] = '\0';
+	*addr = 0;
+	*rec = NULL;
+
+	if (fw->size < sizeof(*ehdr) ||
+	    memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+	    ehdr->e_ident[EI_DATA] != ELFDATA2MSB ||
+	    get_unaligned_be16(&ehdr->e_shentsize) != sizeof(*shdr))
+		return -EINVAL;
+
+	shoff = get_unaligned_be32(&ehdr->e_shoff);
+	shnum = get_unaligned_be16(&ehdr->e_shnum);
+	shstrndx = get_unaligned_be16(&ehdr->e_shstrndx);
+
+	if (shoff > fw->size || shnum > (fw->size - shoff) / sizeof(*shdr) ||
+	    shstrndx >= shnum)
+		return -EINVAL;
+
+	shdr = (const Elf32_Shdr *)(fw->data + shoff);
+	strtab = &shdr[shstrndx];
+	stroff = get_unaligned_be32(&strtab->sh_offset);
+	strsize = get_unaligned_be32(&strtab->sh_size);
+	if (stroff > fw->size || strsize > fw->size - stroff)
+		return -EINVAL;
+
+	for (i = 0; i < shnum; i++) {
+		name = get_unaligned_be32(&shdr[i].sh_name);
+		if (name >= strsize ||
+		    strsize - name < sizeof(MXL371X_FW_VERSION_SECTION) ||
+		    memcmp(fw->data + stroff + name, MXL371X_FW_VERSION_SECTION,
+			   sizeof(MXL371X_FW_VERSION_SECTION)))
+			continue;
+
+		offset = get_unaligned_be32(&shdr[i].sh_offset);
+		size = get_unaligned_be32(&shdr[i].sh_size);
+		if (offset > fw->size || size > fw->size - offset ||
+		    size < MXL371X_FW_VERSION_STR_OFF + MXL371X_FW_VERSION_STR_LEN)
+			return -EINVAL;
+
+		if (!mxl371x_copy_version(version, fw->data + offset +
+					  MXL371X_FW_VERSION_STR_OFF,
+					  MXL371X_FW_VERSION_STR_LEN))
+			return -EINVAL;
+
+		*addr = get_unaligned_be32(&shdr[i].sh_addr);
+		*rec = fw->data + offset;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Remember the version of the image that now runs. This is only done once
+ * it does, so a failed swap keeps describing the old firmware.
+ */
+static void mxl371x_set_fw_image_version(struct mxl371x_priv *priv,
+					 const char *version, u32 addr)
+{
+	strscpy(priv->fw_image_version, version,
+		sizeof(priv->fw_image_version));
+	priv->fw_version_addr = addr;
+}
+
+/* Read the version record of the running firmware back from chip memory */
+static int mxl371x_read_fw_version(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	u8 buf[MXL371X_FW_VERSION_STR_LEN];
+	u32 addr, val;
+	int i, ret;
+
+	addr = (priv->fw_version_addr ?: MXL371X_FW_VERSION_ADDR) +
+	       MXL371X_FW_VERSION_STR_OFF;
+
+	/* Words hold the image bytes in upload order, LSB first */
+	for (i = 0; i < MXL371X_FW_VERSION_STR_LEN; i += 4) {
+		ret = mxl371x_read_mem32(phydev, addr + i, &val);
+		if (ret < 0)
+			return ret;
+
+		put_unaligned_le32(val, &buf[i]);
+	}
+
+	if (!mxl371x_copy_version(priv->fw_version, buf, sizeof(buf)))
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Chip address ranges firmware segments may be loaded to */
+static const struct {
+	u32 start;
+	u32 size;
+} mxl371x_mem_map[] = {
+	{ 0x08000000, 0x00400000 },	/* SYSBUS local 1, SRE */
+	{ 0x0c000000, 0x01000000 },	/* CCPU/DSP memories, SYSBUS local 2/3 */
+};
+
+static bool mxl371x_in_mem_map(u32 addr, u32 size)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(mxl371x_mem_map); i++) {
+		if (addr >= mxl371x_mem_map[i].start &&
+		    size <= mxl371x_mem_map[i].size &&
+		    addr - mxl371x_mem_map[i].start <=
+		    mxl371x_mem_map[i].size - size)
+			return true;
+	}
+
+	return false;
+}
+
+static int mxl371x_fw_seg_cmp(const void *a, const void *b)
+{
+	const struct mxl371x_fw_seg *sa = a, *sb = b;
+
+	return sa->offset < sb->offset ? -1 : sa->offset > sb->offset;
+}
+
+/*
+ * Validate the firmware image and find its loadable segments. This runs
+ * before the SoC is reset, so a truncated or foreign image is rejected
+ * while the old firmware keeps running.
+ *
+ * The driver has no way to program a boot address, the CCPU always starts
+ * at its reset vector. An image loaded by segments must therefore have its
+ * entry point there.
+ */
+static int mxl371x_validate_firmware(struct device *dev,
+				     const struct firmware *fw,
+				     struct mxl371x_fw_image *img,
+				     bool segment_load)
+{
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)fw->data;
+	const Elf32_Phdr *phdr;
+	struct mxl371x_fw_seg *seg;
+	u32 phoff, offset, filesz, memsz, addr, flags;
+	u16 phnum, phentsize;
+	bool entry_ok = false;
+	unsigned int i;
+
+	if (fw->size < sizeof(*ehdr) ||
+	    memcmp(ehdr->e_ident, ELFMAG, SELFMAG)) {
+		dev_err(dev, "Firmware is not an ELF image\n");
+		return -EINVAL;
+	}
+
+	if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+	    ehdr->e_ident[EI_DATA] != ELFDATA2MSB ||
+	    ehdr->e_ident[EI_VERSION] != EV_CURRENT) {
+		dev_err(dev, "Firmware is not a big-endian ELF32 image\n");
+		return -EINVAL;
+	}
+
+	if (get_unaligned_be16(&ehdr->e_type) != ET_EXEC ||
+	    get_unaligned_be16(&ehdr->e_machine) != EM_ARM) {
+		dev_err(dev, "Firmware is not an ARM executable\n");
+		return -EINVAL;
+	}
+
+	phoff = get_unaligned_be32(&ehdr->e_phoff);
+	phnum = get_unaligned_be16(&ehdr->e_phnum);
+	phentsize = get_unaligned_be16(&ehdr->e_phentsize);
+
+	if (phentsize != sizeof(*phdr) || phoff > fw->size ||
+	    phnum > (fw->size - phoff) / sizeof(*phdr)) {
+		dev_err(dev, "Invalid firmware program header table\n");
+		return -EINVAL;
+	}
+
+	img->entry = get_unaligned_be32(&ehdr->e_entry);
+	img->nr_segs = 0;
+
+	for (i = 0; i < phnum; i++) {
+		phdr = (const Elf32_Phdr *)(fw->data + phoff) + i;
+
+		if (get_unaligned_be32(&phdr->p_type) != PT_LOAD)
+			continue;
+
+		offset = get_unaligned_be32(&phdr->p_offset);
+		filesz = get_unaligned_be32(&phdr->p_filesz);
+		memsz = get_unaligned_be32(&phdr->p_memsz);
+		addr = get_unaligned_be32(&phdr->p_paddr);
+		flags = get_unaligned_be32(&phdr->p_flags);
+
+		if (offset > fw->size || filesz > fw->size - offset ||
+		    filesz > memsz) {
+			dev_err(dev, "Firmware segment %u out of bounds\n", i);
+			return -EINVAL;
+		}
+
+		if (!mxl371x_in_mem_map(addr, memsz)) {
+			dev_err(dev, "Firmware segment %u at 0x%08x+0x%x outside chip memory\n",
+				i, addr, memsz);
+			return -EINVAL;
+		}
+
+		if ((flags & PF_X) && img->entry >= addr &&
+		    img->entry - addr < filesz)
+			entry_ok = true;
+
+		/* Zero-initialised memory is set up by the firmware itself */
+		if (!filesz)
+			continue;
+
+		if (img->nr_segs == MXL371X_FW_MAX_SEGS) {
+			dev_err(dev, "Too many firmware segments\n");
+			return -EINVAL;
+		}
+
+		seg = &img->segs[img->nr_segs++];
+		seg->addr = addr;
+		seg->offset = offset;
+		seg->size = filesz;
+	}
+
+	if (!img->nr_segs) {
+		dev_err(dev, "Firmware has no loadable segments\n");
+		return -EINVAL;
+	}
+
+	/*
+	 * Upload in file order, so the digest can be computed along with the
+	 * upload. The load addresses do not depend on the order.
+	 */
+	sort(img->segs, img->nr_segs, sizeof(img->segs[0]),
+	     mxl371x_fw_seg_cmp, NULL);
+
+	for (i = 1; i < img->nr_segs; i++) {
+		if (img->segs[i].offset <
+		    img->segs[i - 1].offset + img->segs[i - 1].size) {
+			dev_err(dev, "Firmware segments overlap at offset 0x%x\n",
+				img->segs[i].offset);
+			return -EINVAL;
+		}
+	}
+
+	if (!entry_ok) {
+		dev_err(dev, "Firmware entry point 0x%08x not in loaded code\n",
+			img->entry);
+		return -EINVAL;
+	}
+
+	if (segment_load && img->entry != MXL371X_CCPU_RESET_VECTOR) {
+		dev_err(dev, "Firmware entry point 0x%08x is not the reset vector 0x%08x\n",
+			img->entry, MXL371X_CCPU_RESET_VECTOR);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_MXL371X_FW_DIGEST
+/* SHA-256 of a firmware upload and the digest it must match */
+struct mxl371x_fw_hash {
+	u8 expected[SHA256_DIGEST_SIZE];
+	struct shash_desc *desc;
+};
+
+/*
+ * Read the expected SHA-256 of firmware @name from "<name>.sha256", as
+ * written by sha256sum. Returns 1 if a digest was read, 0 if there is none
+ * to check against or a negative error code.
+ */
+static int mxl371x_fw_digest(struct phy_device *phydev, const char *name,
+			     u8 *digest)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	const struct firmware *sum;
+	char *sum_name;
+	int ret;
+
+	sum_name = kasprintf(GFP_KERNEL, "%s.sha256", name);
+	if (!sum_name)
+		return -ENOMEM;
+
+	ret = request_firmware_direct(&sum, sum_name, dev);
+	if (ret) {
+		if (priv->fw_digest_required) {
+			dev_err(dev, "Missing firmware digest %s\n", sum_name);
+			ret = -ENOENT;
+		} else {
+			ret = 0;
+		}
+		goto out;
+	}
+
+	if (sum->size < SHA256_DIGEST_SIZE * 2 ||
+	    hex2bin(digest, (const char *)sum->data, SHA256_DIGEST_SIZE)) {
+		dev_err(dev, "Malformed firmware digest %s\n", sum_name);
+		ret = -EINVAL;
+	} else {
+		ret = 1;
+	}
+
+	release_firmware(sum);
+out:
+	kfree(sum_name);
+	return ret;
+}
+
+static void mxl371x_fw_hash_free(struct mxl371x_fw_hash *hash)
+{
+	if (!hash)
+		return;
+
+	if (hash->desc) {
+		crypto_free_shash(hash->desc->tfm);
+		kfree_sensitive(hash->desc);
+	}
+	kfree(hash);
+}
+
+/*
+ * Start hashing the upload of firmware @name if a digest was published for
+ * it. Returns NULL if there is nothing to check against or an ERR_PTR().
+ */
+static struct mxl371x_fw_hash *mxl371x_fw_hash_start(struct phy_device *phydev,
+						     const char *name)
+{
+	struct device *dev = &phydev->mdio.dev;
+	struct mxl371x_fw_hash *hash;
+	struct crypto_shash *tfm;
+	int ret;
+
+	hash = kzalloc(sizeof(*hash), GFP_KERNEL);
+	if (!hash)
+		return ERR_PTR(-ENOMEM);
+
+	ret = mxl371x_fw_digest(phydev, name, hash->expected);
+	if (ret <= 0)
+		goto err;
+
+	tfm = crypto_alloc_shash("sha256", 0, 0);
+	if (IS_ERR(tfm)) {
+		ret = PTR_ERR(tfm);
+		dev_err(dev, "Cannot allocate sha256: %d\n", ret);
+		goto err;
+	}
+
+	hash->desc = kzalloc(sizeof(*hash->desc) + crypto_shash_descsize(tfm),
+			     GFP_KERNEL);
+	if (!hash->desc) {
+		crypto_free_shash(tfm);
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	hash->desc->tfm = tfm;
+	ret = crypto_shash_init(hash->desc);
+	if (ret < 0)
+		goto err;
+
+	dev_info(dev, "Verifying firmware with %s\n",
+		 crypto_shash_driver_name(tfm));
+	return hash;
+
+err:
+	mxl371x_fw_hash_free(hash);
+	return ret < 0 ? ERR_PTR(ret) : NULL;
+}
+
+static int mxl371x_fw_hash_update(struct mxl371x_fw_hash *hash,
+				  const u8 *data, u32 len)
+{
+	return hash ? crypto_shash_update(hash->desc, data, len) : 0;
+}
+
+/* Only start an image that matches its published digest */
+static int mxl371x_fw_hash_verify(struct phy_device *phydev,
+				  struct mxl371x_fw_hash *hash)
+{
+	struct device *dev = &phydev->mdio.dev;
+	u8 digest[SHA256_DIGEST_SIZE];
+	int ret;
+
+	if (!hash)
+		return 0;
+
+	ret = crypto_shash_final(hash->desc, digest);
+	if (ret < 0)
+		return ret;
+
+	if (memcmp(digest, hash->expected, sizeof(digest))) {
+		dev_err(dev, "Firmware digest mismatch, SoC left in reset\n");
+		return -EBADMSG;
+	}
+
+	dev_info(dev, "Firmware digest verified\n");
+	return 0;
+}
+#else
+struct mxl371x_fw_hash;
+
+static struct mxl371x_fw_hash *mxl371x_fw_hash_start(struct phy_device *phydev,
+						     const char *name)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+
+	if (priv->fw_digest_required) {
+		dev_err(&phydev->mdio.dev,
+			"Firmware digest required, but digest support is not built in\n");
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	return NULL;
+}
+
+static int mxl371x_fw_hash_update(struct mxl371x_fw_hash *hash,
+				  const u8 *data, u32 len)
+{
+	return 0;
+}
+
+static int mxl371x_fw_hash_verify(struct phy_device *phydev,
+				  struct mxl371x_fw_hash *hash)
+{
+	return 0;
+}
+
+static void mxl371x_fw_hash_free(struct mxl371x_fw_hash *hash)
+{
+}
+#endif /* CONFIG_MXL371X_FW_DIGEST */
+
+/*
+ * Write a block of the image to chip memory, one 32-bit word at a time.
+ *
+ * With @sparse, chip memory is known to be zero, so zero words are
+ * skipped. Every word carries its own address, which means even a single
+ * zero word saves a full write and no minimum run length is needed.
+ */
+static int mxl371x_upload(struct phy_device *phydev, u32 addr,
+			  const u8 *data, u32 len, struct mxl371x_fw_hash *hash,
+			  bool sparse)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	u32 i;
+	int ret;
+
+	for (i = 0; i < len; i += 4) {
+		u32 word = 0;
+		int j;
+
+		/* Hash each chunk while it is still hot in the cache */
+		if (hash && i % MXL371X_FW_HASH_CHUNK == 0) {
+			ret = mxl371x_fw_hash_update(hash, data + i,
+					min_t(u32, len - i, MXL371X_FW_HASH_CHUNK));
+			if (ret < 0)
+				return ret;
+		}
+
+		/* Construct 32-bit word from firmware bytes */
+		for (j = 0; j < 4 && (i + j) < len; j++)
+			word |= ((u32)data[i + j]) << (j * 8);
+
+		if (!word && sparse) {
+			priv->boot.skipped_words++;
+			continue;
+		}
+
+		ret = mxl371x_write_mem32(phydev, addr + i, word);
+		if (ret < 0) {
+			dev_err(dev, "Firmware write failed at 0x%08x\n",
+				addr + i);
+			return ret;
+		}
+
+		/* Progress indication every 256KB */
+		if (i % 262144 == 0 && i > 0)
+			dev_dbg(dev, "Uploaded %u%% of block at 0x%08x\n",
+				(u32)div_u64((u64)i * 100, len), addr);
+	}
+
+	return 0;
+}
+
+/*
+ * Load firmware @name unless the same image is already running. With @force
+ * the image is always uploaded and an unusable file is an error even when
+ * firmware is running.
+ *
+ * Returns 1 if the running firmware was kept (warm boot), 0 after a fresh
+ * load or a negative error code.
+ */
+static int mxl371x_load_firmware(struct phy_device *phydev, const char *name,
+				 bool force)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 	const struct firmware *fw;
 	struct device *dev = &phydev->mdio.dev;
+	struct mxl371x_fw_image img;
+	struct mxl371x_fw_hash *hash = NULL;
+	char version[MXL371X_FW_VERSION_STR_LEN + 1];
+	size_t uploaded = 0;
+	ktime_t start;
+	const u8 *rec = NULL;
+	u32 version_addr;
+	bool sparse = false;
+	bool status_ok;
+	u32 pos = 0;
 	int ret;
 	u32 i, fw_status;
 
-	/* Check if already loaded */
-	if (priv->fw_loaded)
-		return 0;
-
-	/* Check if firmware is already running (warm boot) */
-	if (mxl371x_check_firmware_running(phydev)) {
-		priv->fw_loaded = true;
-		dev_info(dev, "Skipping firmware load (already running)\n");
-		return 0;
-	}
+	lockdep_assert_held(&priv->lock);
 
-	dev_info(dev, "Loading firmware %s...\n", priv->fw_name);
+	/* Check if already loaded */
+	if (priv->state == MXL371X_STATE_RUNNING && !force)
+		return 1;
 
-	ret = request_firmware(&fw, priv->fw_name, dev);
+	start = ktime_get();
+	ret = request_firmware(&fw, name, dev);
 	if (ret) {
+		/* Without the file, trust whatever is running */
+		if (!force && mxl371x_check_firmware_running(phydev, NULL, 0)) {
+			dev_warn(dev, "Cannot verify running firmware without %s\n",
+				 name);
+			mxl371x_set_state(priv, MXL371X_STATE_RUNNING);
+			return 1;
+		}
+
 		dev_err(dev, "Failed to load firmware: %d\n", ret);
 		return ret;
 	}
@@ -868,12 +2916,76 @@ static int mxl371x_load_firmware(struct phy_device *phydev)
 	if (fw->size == 0 || fw->size > MXL371X_MAX_FW_SIZE) {
 		dev_err(dev, "Invalid firmware size: %zu\n", fw->size);
 		ret = -EINVAL;
+		goto bad_fw;
+	}
+
+	/* Reject unusable images before the chip is touched */
+	ret = mxl371x_validate_firmware(dev, fw, &img, priv->fw_segment_load);
+	if (ret < 0)
+		goto bad_fw;
+
+	if (mxl371x_fw_image_version(fw, version, &version_addr, &rec) == 0)
+		dev_info(dev, "Firmware image version %s\n", version);
+	else
+		dev_warn(dev, "No version record in %s, cannot match a running firmware\n",
+			 name);
+
+	/* Check if this image is already running (warm boot) */
+	if (!force && rec &&
+	    mxl371x_check_firmware_running(phydev, rec, version_addr)) {
+		mxl371x_set_fw_image_version(priv, version, version_addr);
+		mxl371x_set_state(priv, MXL371X_STATE_RUNNING);
+		dev_info(dev, "Skipping firmware load (already running)\n");
+		ret = 1;
 		goto release_fw;
 	}
 
+	hash = mxl371x_fw_hash_start(phydev, name);
+	if (IS_ERR(hash)) {
+		ret = PTR_ERR(hash);
+		hash = NULL;
+		goto bad_fw;
+	}
+
+	status_ok = mxl371x_read_mem32(phydev, MXL371X_FW_STATUS_REG,
+				       &fw_status) == 0;
+
+	/*
+	 * On a cold boot the digest is computed during the upload, see below.
+	 * A running firmware must not be stopped for an image that turns out
+	 * to be wrong, so it is checked over the whole file first.
+	 */
+	if (hash && (force || !status_ok || (fw_status & MXL371X_FW_RUNNING))) {
+		ret = mxl371x_fw_hash_update(hash, fw->data, fw->size);
+		if (ret == 0)
+			ret = mxl371x_fw_hash_verify(phydev, hash);
+		if (ret < 0)
+			goto bad_fw;
+
+		mxl371x_fw_hash_free(hash);
+		hash = NULL;
+	}
+
+	dev_info(dev, "Loading firmware %s...\n", name);
+	priv->boot.request_ms = ktime_ms_delta(ktime_get(), start);
+
 	dev_info(dev, "Firmware size: %zu bytes\n", fw->size);
 
+	/*
+	 * Zero words may only be skipped over memory cleared by a power-on
+	 * reset. A firmware that ran before leaves its code and data behind,
+	 * and holding the CPU in reset does not clear them.
+	 */
+	if (priv->fw_sparse_upload) {
+		sparse = !force && status_ok &&
+			 !(fw_status & (MXL371X_FW_LOADED | MXL371X_FW_RUNNING |
+					MXL371X_FW_ERROR));
+		if (!sparse)
+			dev_info(dev, "Chip ran firmware before, uploading zero words\n");
+	}
+
 	/* Reset SoC - hold in reset */
+	mxl371x_set_state(priv, MXL371X_STATE_LOADING);
 	ret = mxl371x_write_mem32(phydev, SRE_CPU_SRC_SEL_CSR, 0x8);
 	if (ret < 0) {
 		dev_err(dev, "Failed to reset SoC\n");
@@ -883,26 +2995,52 @@ static int mxl371x_load_firmware(struct phy_device *phydev)
 
 	/* Upload firmware in chunks */
 	dev_info(dev, "Uploading firmware...\n");
-	for (i = 0; i < fw->size; i += 4) {
-		u32 word = 0;
-		int j;
-
-		/* Construct 32-bit word from firmware bytes */
-		for (j = 0; j < 4 && (i + j) < fw->size; j++)
-			word |= ((u32)fw->data[i + j]) << (j * 8);
+	priv->boot.skipped_words = 0;
+	if (priv->fw_segment_load) {
+		/* Only the loadable contents, each to its load address */
+		for (i = 0; i < img.nr_segs; i++) {
+			/* Parts of the file between segments are hashed only */
+			if (hash) {
+				ret = mxl371x_fw_hash_update(hash, fw->data + pos,
+						img.segs[i].offset - pos);
+				if (ret < 0)
+					goto release_fw;
+
+				pos = img.segs[i].offset + img.segs[i].size;
+			}
+
+			ret = mxl371x_upload(phydev, img.segs[i].addr,
+					     fw->data + img.segs[i].offset,
+					     img.segs[i].size, hash, sparse);
+			if (ret < 0)
+				goto release_fw;
+
+			uploaded += img.segs[i].size;
+		}
 
-		ret = mxl371x_write_mem32(phydev, MXL371X_FW_BASE_ADDR + i, word);
-		if (ret < 0) {
-			dev_err(dev, "Firmware write failed at offset %u\n", i);
+		dev_info(dev, "Loaded %u segments\n", img.nr_segs);
+	} else {
+		ret = mxl371x_upload(phydev, MXL371X_FW_BASE_ADDR, fw->data,
+				     fw->size, hash, sparse);
+		if (ret < 0)
 			goto release_fw;
-		}
 
-		/* Progress indication every 256KB */
-		if (i % 262144 == 0 && i > 0)
-			dev_dbg(dev, "Uploaded %zu%%\n", (i * 100) / fw->size);
+		uploaded = fw->size;
+		pos = fw->size;
 	}
 
-	dev_info(dev, "Firmware upload complete (%zu bytes)\n", fw->size);
+	dev_info(dev, "Firmware upload complete (%zu bytes)\n", uploaded);
+	if (sparse)
+		dev_info(dev, "Skipped %u zero words (%u bytes)\n",
+			 priv->boot.skipped_words, priv->boot.skipped_words * 4);
+	ret = mxl371x_fw_hash_update(hash, fw->data + pos, fw->size - pos);
+	if (ret == 0)
+		ret = mxl371x_fw_hash_verify(phydev, hash);
+	if (ret < 0)
+		goto release_fw;
+
+	priv->boot.upload_ms = ktime_ms_delta(ktime_get(), start) -
+			       priv->boot.request_ms;
 
 	/* Release SoC from reset */
 	ret = mxl371x_write_mem32(phydev, SRE_CPU_SRC_SEL_CSR, 0x0);
@@ -925,7 +3063,13 @@ static int mxl371x_load_firmware(struct phy_device *phydev)
 
 		if (fw_status & MXL371X_FW_RUNNING) {
 			dev_info(dev, "Firmware started successfully\n");
-			priv->fw_loaded = true;
+
+			priv->boot.start_ms = ktime_ms_delta(ktime_get(), start) -
+					      priv->boot.request_ms -
+					      priv->boot.upload_ms;
+			mxl371x_set_fw_image_version(priv, version,
+						     version_addr);
+			mxl371x_set_state(priv, MXL371X_STATE_RUNNING);
 			ret = 0;
 			goto release_fw;
 		}
@@ -942,8 +3086,23 @@ static int mxl371x_load_firmware(struct phy_device *phydev)
 
 	dev_err(dev, "Firmware start timeout (status: 0x%08x)\n", fw_status);
 	ret = -ETIMEDOUT;
+	goto release_fw;
+
+bad_fw:
+	/* The chip was not touched, keep a running firmware in service */
+	if (!force && mxl371x_check_firmware_running(phydev, NULL, 0)) {
+		dev_warn(dev, "Keeping running firmware, %s is unusable\n",
+			 name);
+		mxl371x_set_state(priv, MXL371X_STATE_RUNNING);
+		ret = 1;
+	}
 
 release_fw:
+	/* The old firmware is gone once the SoC has been reset */
+	if (ret < 0 && priv->state == MXL371X_STATE_LOADING)
+		mxl371x_set_state(priv, MXL371X_STATE_ERROR);
+
+	mxl371x_fw_hash_free(hash);
 	release_firmware(fw);
 	return ret;
 }
@@ -990,6 +3149,7 @@ static int mxl371x_detect_sgmii_mode(struct phy_device *phydev, u8 *detected_mod
 
 static int mxl371x_config_sgmii(struct phy_device *phydev)
 {
+	struct mxl371x_priv *priv = phydev->priv;
 	struct device *dev = &phydev->mdio.dev;
 	int ret;
 	u8 mode;
@@ -1043,12 +3203,9 @@ static int mxl371x_config_sgmii(struct phy_device *phydev)
 		mode = MXL371X_SGMII_MODE_SGMII;
 		phydev->speed = SPEED_1000;
 
-		/* Could also check MoCA version as fallback:
-		 * if (priv->moca_version >= MOCA_VER_2_5) {
-		 * mode = MXL371X_SGMII_MODE_HSGMII;
-		 * phydev->speed = SPEED_2500;
-		 * }
-		 */
+		/* With maxlinear,auto-host-interface this is upgraded to
+		 * HSGMII once a MoCA 2.5 network is found, see
+		 * mxl371x_update_host_interface() */
 	}
 
 	/* Configure the SGMII interface */
@@ -1065,9 +3222,164 @@ static int mxl371x_config_sgmii(struct phy_device *phydev)
 		 mode == MXL371X_SGMII_MODE_1000BASE_X ? "1000BASE-X" : "SGMII",
 		 phydev->speed);
 
+	/* Tell phylink which mode is in use, also when it was detected */
+	if (mode == MXL371X_SGMII_MODE_HSGMII)
+		phydev->interface = PHY_INTERFACE_MODE_2500BASEX;
+	else if (mode == MXL371X_SGMII_MODE_1000BASE_X)
+		phydev->interface = PHY_INTERFACE_MODE_1000BASEX;
+	else
+		phydev->interface = PHY_INTERFACE_MODE_SGMII;
+
+	/* Modes the host interface may switch to at runtime */
+	phy_interface_zero(phydev->possible_interfaces);
+	__set_bit(phydev->interface, phydev->possible_interfaces);
+	if (priv->auto_host_if) {
+		__set_bit(PHY_INTERFACE_MODE_SGMII, phydev->possible_interfaces);
+		__set_bit(PHY_INTERFACE_MODE_2500BASEX,
+			  phydev->possible_interfaces);
+	}
+
 	return 0;
 }
 
+/*
+ * Replace the running firmware with @name. The GUID lives in chip memory and
+ * is lost with the old firmware, so it is saved first and written back once
+ * the new image runs. Called with phydev->lock and priv->lock held.
+ */
+static int mxl371x_swap_firmware(struct phy_device *phydev, const char *name)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	u32 mac_hi, mac_lo;
+	bool have_guid;
+	int ret;
+
+	have_guid = priv->state == MXL371X_STATE_RUNNING &&
+		    mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_HI, &mac_hi) == 0 &&
+		    mxl371x_read_mem32(phydev, MOCA_MAC_ADDR_LO, &mac_lo) == 0 &&
+		    (mac_hi || mac_lo);
+
+	ret = mxl371x_load_firmware(phydev, name, true);
+	if (ret < 0)
+		return ret;
+
+	strscpy(priv->fw_name_buf, name, sizeof(priv->fw_name_buf));
+	priv->fw_name = priv->fw_name_buf;
+
+	if (mxl371x_read_fw_version(phydev) == 0)
+		dev_info(dev, "Running firmware version %s\n", priv->fw_version);
+	else
+		strscpy(priv->fw_version, "unknown", sizeof(priv->fw_version));
+
+	if (have_guid &&
+	    mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_HI, mac_hi) == 0 &&
+	    mxl371x_write_mem32(phydev, MOCA_MAC_ADDR_LO, mac_lo) == 0)
+		dev_info(dev, "Restored MoCA GUID\n");
+	else if (mxl371x_set_default_guid(phydev) < 0)
+		dev_warn(dev, "Failed to set MoCA GUID\n");
+
+	mxl371x_read_moca_status(phydev);
+
+	return mxl371x_config_sgmii(phydev);
+}
+
+/* Live firmware swap - write a file name, read the last outcome */
+static ssize_t moca_fw_load_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+
+	if (!priv->fw_swap.name[0])
+		return sprintf(buf, "none\n");
+
+	return sprintf(buf, "%s %d %u\n", priv->fw_swap.name,
+		       priv->fw_swap.result, priv->fw_swap.ms);
+}
+
+static ssize_t moca_fw_load_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct phy_device *phydev = to_phy_device(dev);
+	struct mxl371x_priv *priv = phydev->priv;
+	char tmp[MXL371X_FW_NAME_LEN], *name;
+	ktime_t start;
+	int ret;
+
+	if (strscpy(tmp, buf, sizeof(tmp)) < 0)
+		return -ENAMETOOLONG;
+
+	/* Plain file names only, resolved in the firmware search path */
+	name = strim(tmp);
+	if (!*name || strchr(name, '/'))
+		return -EINVAL;
+
+	start = ktime_get();
+
+	/* The poller and other chip users back off while loading */
+	mutex_lock(&phydev->lock);
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_RUNNING ||
+	    priv->state == MXL371X_STATE_ERROR)
+		ret = mxl371x_swap_firmware(phydev, name);
+	else
+		ret = -EBUSY;
+	mxl371x_metrics_publish(priv);
+	mutex_unlock(&priv->lock);
+	mutex_unlock(&phydev->lock);
+
+	strscpy(priv->fw_swap.name, name, sizeof(priv->fw_swap.name));
+	priv->fw_swap.result = ret;
+	priv->fw_swap.ms = ktime_ms_delta(ktime_get(), start);
+
+	if (ret < 0) {
+		dev_err(dev, "Firmware swap to %s failed: %d\n", name, ret);
+		return ret;
+	}
+
+	dev_info(dev, "Firmware swapped to %s in %u ms\n", name,
+		 priv->fw_swap.ms);
+	return count;
+}
+static DEVICE_ATTR_RW(moca_fw_load);
+
+static struct attribute *mxl371x_attrs[] = {
+	&dev_attr_moca_state.attr,
+	&dev_attr_moca_link_status.attr,
+	&dev_attr_moca_version.attr,
+	&dev_attr_moca_phy_rate.attr,
+	&dev_attr_moca_node_id.attr,
+	&dev_attr_moca_nc_node_id.attr,
+	&dev_attr_moca_nc_handoffs.attr,
+	&dev_attr_moca_nc_tenure.attr,
+	&dev_attr_moca_lof.attr,
+	&dev_attr_moca_network_state.attr,
+	&dev_attr_moca_active_nodes.attr,
+	&dev_attr_moca_security_enabled.attr,
+	&dev_attr_moca_chip_type.attr,
+	&dev_attr_moca_fw_version.attr,
+	&dev_attr_moca_fw_image_version.attr,
+	&dev_attr_moca_soc_version.attr,
+	&dev_attr_moca_guid.attr,
+	&dev_attr_moca_metrics.attr,
+	&dev_attr_moca_link_up_delay_ms.attr,
+	&dev_attr_moca_link_down_delay_ms.attr,
+	&dev_attr_moca_link_dampening.attr,
+	&dev_attr_moca_link_flaps.attr,
+	&dev_attr_moca_link_suppressed.attr,
+	&dev_attr_moca_alert_rate_drop_pct.attr,
+	&dev_attr_moca_alert_rx_errors_ps.attr,
+	&dev_attr_moca_alert_temp.attr,
+	&dev_attr_moca_fw_load.attr,
+	NULL,
+};
+
+static const struct attribute_group mxl371x_attr_group = {
+	.attrs = mxl371x_attrs,
+};
+
 static int mxl371x_config_init(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
@@ -1075,25 +3387,34 @@ static int mxl371x_config_init(struct phy_device *phydev)
 	int ret;
 	bool warm_boot = false;
 
+	mutex_lock(&priv->lock);
+
+	if (priv->state == MXL371X_STATE_SUSPENDED ||
+	    priv->state == MXL371X_STATE_ERROR)
+		mxl371x_set_state(priv, MXL371X_STATE_RECOVERING);
+
 	/* Get device information */
 	ret = mxl371x_get_device_info(phydev);
 	if (ret < 0)
-		return ret;
-
-	/* Check if this is a warm boot */
-	warm_boot = mxl371x_check_firmware_running(phydev);
-	if (warm_boot) {
-		priv->fw_loaded = true;
-		dev_info(dev, "Warm boot detected, skipping firmware load\n");
-	}
+		goto err;
 
-	/* Load firmware (will be skipped if already running) */
-	ret = mxl371x_load_firmware(phydev);
+	/* Load firmware (skipped if the same image is already running) */
+	ret = mxl371x_load_firmware(phydev, priv->fw_name, false);
 	if (ret < 0) {
 		dev_err(dev, "Firmware loading failed: %d\n", ret);
-		return ret;
+		goto err;
 	}
 
+	warm_boot = ret > 0;
+	if (warm_boot)
+		dev_info(dev, "Warm boot detected, skipping firmware load\n");
+
+	/* Cache the version the running firmware reports about itself */
+	if (mxl371x_read_fw_version(phydev) == 0)
+		dev_info(dev, "Running firmware version %s\n", priv->fw_version);
+	else
+		strscpy(priv->fw_version, "unknown", sizeof(priv->fw_version));
+
 	/* Set default MoCA GUID if not already configured
 	 * On warm boot, this will use existing GUID from hardware */
 	ret = mxl371x_set_default_guid(phydev);
@@ -1108,24 +3429,14 @@ static int mxl371x_config_init(struct phy_device *phydev)
 	ret = mxl371x_config_sgmii(phydev);
 	if (ret < 0) {
 		dev_err(dev, "SGMII configuration failed: %d\n", ret);
-		return ret;
-	}
-
-	/* Create sysfs attributes */
-	ret = sysfs_create_group(&phydev->mdio.dev.kobj, &mxl371x_attr_group);
-	if (ret < 0) {
-		dev_err(dev, "Failed to create sysfs attributes: %d\n", ret);
-		return ret;
+		goto err;
 	}
 
-	/* Initialize hwmon temperature sensor */
-	ret = mxl371x_hwmon_init(phydev);
-	if (ret < 0)
-		dev_warn(dev, "Failed to init hwmon: %d\n", ret);
+	mxl371x_metrics_publish(priv);
+	mutex_unlock(&priv->lock);
 
-	/* Start statistics polling */
-	INIT_DELAYED_WORK(&priv->stats_poll, mxl371x_stats_poll_work);
-	schedule_delayed_work(&priv->stats_poll, HZ);
+	/* Start statistics polling (no-op if already queued) */
+	schedule_delayed_work(&priv->stats_poll, MXL371X_POLL_INTERVAL);
 
 	if (warm_boot) {
 		dev_info(dev, "MoCA PHY initialized (warm boot, MoCA v%u.%u, %uMbps)\n",
@@ -1138,17 +3449,88 @@ static int mxl371x_config_init(struct phy_device *phydev)
 	}
 
 	return 0;
+
+err:
+	mxl371x_set_state(priv, MXL371X_STATE_ERROR);
+	mxl371x_metrics_publish(priv);
+	mutex_unlock(&priv->lock);
+	return ret;
 }
 
 static int mxl371x_probe(struct phy_device *phydev)
 {
+	struct device *dev = &phydev->mdio.dev;
 	struct mxl371x_priv *priv;
+	int i, ret;
 
-	priv = devm_kzalloc(&phydev->mdio.dev, sizeof(*priv), GFP_KERNEL);
+	priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
 
+	ret = devm_mutex_init(dev, &priv->lock);
+	if (ret)
+		return ret;
+
+	seqcount_mutex_init(&priv->metrics_seq, &priv->lock);
+
+	priv->phydev = phydev;
+	priv->state = MXL371X_STATE_PROBING;
+	INIT_DELAYED_WORK(&priv->stats_poll, mxl371x_stats_poll_work);
+	priv->link.dampening = true;
+	priv->link.penalty_stamp = jiffies;
+
+	/* Optional firmware loading and carrier hold-down settings from DT */
+	if (dev->of_node) {
+		priv->fw_segment_load =
+			of_property_read_bool(dev->of_node,
+					      "maxlinear,fw-segment-load");
+		priv->fw_sparse_upload =
+			of_property_read_bool(dev->of_node,
+					      "maxlinear,fw-sparse-upload");
+		priv->fw_digest_required =
+			of_property_read_bool(dev->of_node,
+					      "maxlinear,fw-digest-required");
+		priv->auto_host_if =
+			of_property_read_bool(dev->of_node,
+					      "maxlinear,auto-host-interface");
+		of_property_read_u32(dev->of_node, "maxlinear,link-up-delay-ms",
+				     &priv->link.up_delay_ms);
+		of_property_read_u32(dev->of_node, "maxlinear,link-down-delay-ms",
+				     &priv->link.down_delay_ms);
+		priv->link.up_delay_ms = min_t(u32, priv->link.up_delay_ms,
+					       MXL371X_LINK_DELAY_MAX_MS);
+		priv->link.down_delay_ms = min_t(u32, priv->link.down_delay_ms,
+						 MXL371X_LINK_DELAY_MAX_MS);
+	}
+
+	for (i = 0; i < MXL371X_ALERT_NUM; i++) {
+		ratelimit_state_init(&priv->alert.rs[i], MXL371X_ALERT_INTERVAL, 1);
+		ratelimit_set_flags(&priv->alert.rs[i],
+				    RATELIMIT_MSG_ON_RELEASE);
+	}
+
+	ewma_mxl371x_rate_init(&priv->tx_rate);
+	ewma_mxl371x_rate_init(&priv->rx_rate);
+	atomic64_set(&priv->mdio_xfers, 0);
+
 	phydev->priv = priv;
+
+	ret = mxl371x_history_init(phydev);
+	if (ret < 0)
+		dev_warn(dev, "Failed to allocate link history: %d\n", ret);
+
+	/* Created once here, config_init() runs again on every resume */
+	ret = sysfs_create_group(&dev->kobj, &mxl371x_attr_group);
+	if (ret < 0) {
+		dev_err(dev, "Failed to create sysfs attributes: %d\n", ret);
+		return ret;
+	}
+
+	ret = mxl371x_hwmon_init(phydev);
+	if (ret < 0)
+		dev_warn(dev, "Failed to init hwmon: %d\n", ret);
+
+	mxl371x_debugfs_init(phydev);
 	return 0;
 }
 
@@ -1156,25 +3538,167 @@ static void mxl371x_remove(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 
-	cancel_delayed_work_sync(&priv->stats_poll);
 	sysfs_remove_group(&phydev->mdio.dev.kobj, &mxl371x_attr_group);
+	cancel_delayed_work_sync(&priv->stats_poll);
+	mxl371x_debugfs_remove(phydev);
+}
+
+/* Halve the flap penalty once per elapsed half-life */
+static void mxl371x_decay_penalty(struct mxl371x_priv *priv, unsigned long now)
+{
+	while (priv->link.penalty &&
+	       time_after_eq(now, priv->link.penalty_stamp +
+				  MXL371X_FLAP_HALF_LIFE)) {
+		priv->link.penalty >>= 1;
+		priv->link.penalty_stamp += MXL371X_FLAP_HALF_LIFE;
+	}
+
+	if (!priv->link.penalty)
+		priv->link.penalty_stamp = now;
+
+	if (priv->link.suppressed && priv->link.penalty < MXL371X_FLAP_REUSE)
+		priv->link.suppressed = false;
+}
+
+/*
+ * Turn the raw MoCA link state into the carrier reported to phylib.
+ *
+ * A change of the raw state only propagates once it has been stable for
+ * the up or down delay. Every loss of the raw link is a flap and adds to
+ * a penalty that decays exponentially; while the penalty is above the
+ * suppress threshold the carrier is held down until it decays below the
+ * reuse threshold.
+ */
+static bool mxl371x_link_dampen(struct phy_device *phydev, bool raw)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	unsigned long now = jiffies;
+	u32 hold_ms;
+
+	mxl371x_decay_penalty(priv, now);
+
+	if (raw != priv->link.raw) {
+		priv->link.raw = raw;
+		priv->link.raw_since = now;
+
+		if (!raw) {
+			priv->link.flaps++;
+			priv->link.penalty = min(priv->link.penalty +
+						 MXL371X_FLAP_PENALTY,
+						 MXL371X_FLAP_PENALTY_MAX);
+
+			if (READ_ONCE(priv->link.dampening) &&
+			    !priv->link.suppressed &&
+			    priv->link.penalty >= MXL371X_FLAP_SUPPRESS) {
+				priv->link.suppressed = true;
+				dev_warn(dev, "MoCA link flapping, suppressing carrier\n");
+			}
+		}
+	}
+
+	if (raw == priv->link.carrier)
+		return priv->link.carrier;
+
+	if (raw && priv->link.suppressed && READ_ONCE(priv->link.dampening))
+		return false;
+
+	hold_ms = raw ? READ_ONCE(priv->link.up_delay_ms) :
+			READ_ONCE(priv->link.down_delay_ms);
+	if (time_before(now, priv->link.raw_since + msecs_to_jiffies(hold_ms)))
+		return priv->link.carrier;
+
+	priv->link.carrier = raw;
+	return raw;
+}
+
+/*
+ * Follow the MoCA network with the host interface: HSGMII on a MoCA 2.5
+ * network whose PHY rate exceeds what SGMII carries, back to SGMII from
+ * HSGMII on older networks. Any other mode chosen in the device tree is
+ * left alone on older networks. A 2.5 network at a lower rate keeps the
+ * current mode so a fluctuating rate does not toggle the SerDes.
+ *
+ * phylink only picks up phydev->interface on a link change. Returns true if
+ * the mode was switched, so the caller can take the link down first.
+ */
+static bool mxl371x_update_host_interface(struct phy_device *phydev)
+{
+	struct mxl371x_priv *priv = phydev->priv;
+	struct device *dev = &phydev->mdio.dev;
+	phy_interface_t interface;
+	char event[48];
+	char *envp[] = { event, NULL };
+	u8 mode;
+	int ret;
+
+	if (priv->moca_version < MOCA_VER_2_5) {
+		if (phydev->interface != PHY_INTERFACE_MODE_2500BASEX)
+			return false;
+
+		interface = PHY_INTERFACE_MODE_SGMII;
+		mode = MXL371X_SGMII_MODE_SGMII;
+	} else if (priv->phy_rate > MXL371X_HSGMII_MIN_RATE) {
+		interface = PHY_INTERFACE_MODE_2500BASEX;
+		mode = MXL371X_SGMII_MODE_HSGMII;
+	} else {
+		return false;
+	}
+
+	if (interface == phydev->interface)
+		return false;
+
+	ret = phy_modify_paged(phydev, MXL371X_SGMII_CTRL, 0x10,
+			       MXL371X_SGMII_MODE_MASK, mode);
+	if (ret < 0) {
+		dev_err(dev, "Failed to switch host interface: %d\n", ret);
+		return false;
+	}
+
+	dev_info(dev, "MoCA v%u.%u network at %uMbps, host interface %s -> %s\n",
+		 priv->moca_version >> 4, priv->moca_version & 0xf,
+		 priv->phy_rate, phy_modes(phydev->interface),
+		 phy_modes(interface));
+
+	phydev->interface = interface;
+	phydev->speed = mode == MXL371X_SGMII_MODE_HSGMII ? SPEED_2500 :
+							    SPEED_1000;
+
+	snprintf(event, sizeof(event), "MOCA_HOST_INTERFACE=%s",
+		 phy_modes(interface));
+	kobject_uevent_env(&dev->kobj, KOBJ_CHANGE, envp);
+	return true;
 }
 
 static int mxl371x_read_status(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
+	bool was_up = phydev->link;
+	bool up;
 	int ret;
 
-	ret = genphy_read_status(phydev);
-	if (ret < 0)
-		return ret;
+	mutex_lock(&priv->lock);
 
-	if (priv->fw_loaded) {
+	ret = genphy_read_status(phydev);
+	if (ret == 0 && priv->state == MXL371X_STATE_RUNNING) {
 		mxl371x_read_moca_status(phydev);
-		phydev->link = (priv->link_status == MOCA_LINK_UP);
+		up = priv->link_status == MOCA_LINK_UP;
+		phydev->link = mxl371x_link_dampen(phydev, up);
+
+		/*
+		 * A switch on a link that is already up (the rate grew past
+		 * SGMII) is reported as a link down for this poll, so phylink
+		 * reconfigures the MAC when the link comes back on the next.
+		 */
+		if (priv->auto_host_if && up &&
+		    mxl371x_update_host_interface(phydev) && was_up)
+			phydev->link = 0;
+
+		mxl371x_metrics_publish(priv);
 	}
 
-	return 0;
+	mutex_unlock(&priv->lock);
+	return ret;
 }
 
 static int mxl371x_config_aneg(struct phy_device *phydev)
@@ -1184,10 +3708,57 @@ static int mxl371x_config_aneg(struct phy_device *phydev)
 	return 0;
 }
 
+/*
+ * The MoCA side has no Ethernet speed. Frames are buffered in the chip and
+ * the host link always runs at the full rate of its interface, with pause
+ * frames towards the MAC when the coax is slower.
+ */
+static int mxl371x_get_rate_matching(struct phy_device *phydev,
+				     phy_interface_t iface)
+{
+	switch (iface) {
+	case PHY_INTERFACE_MODE_SGMII:
+	case PHY_INTERFACE_MODE_1000BASEX:
+	case PHY_INTERFACE_MODE_2500BASEX:
+		return RATE_MATCH_PAUSE;
+	default:
+		return RATE_MATCH_NONE;
+	}
+}
+
+/*
+ * Link state comes from the firmware over MDIO and the SerDes runs at a
+ * fixed speed, so in-band negotiation is not used in any host mode. Saying
+ * so lets phylink set up the MAC PCS out-of-band, notably for 2500base-x
+ * where in-band status is not defined.
+ */
+static unsigned int mxl371x_inband_caps(struct phy_device *phydev,
+					phy_interface_t interface)
+{
+	switch (interface) {
+	case PHY_INTERFACE_MODE_SGMII:
+	case PHY_INTERFACE_MODE_1000BASEX:
+	case PHY_INTERFACE_MODE_2500BASEX:
+		return LINK_INBAND_DISABLE;
+	default:
+		return 0;
+	}
+}
+
+static int mxl371x_config_inband(struct phy_device *phydev, unsigned int modes)
+{
+	return modes == LINK_INBAND_DISABLE ? 0 : -EOPNOTSUPP;
+}
+
 static int mxl371x_suspend(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 
+	mutex_lock(&priv->lock);
+	mxl371x_set_state(priv, MXL371X_STATE_SUSPENDED);
+	mutex_unlock(&priv->lock);
+
+	/* Not under priv->lock, the poller takes it */
 	cancel_delayed_work_sync(&priv->stats_poll);
 	return genphy_suspend(phydev);
 }
@@ -1196,8 +3767,12 @@ static int mxl371x_resume(struct phy_device *phydev)
 {
 	struct mxl371x_priv *priv = phydev->priv;
 
-	priv->fw_loaded = false;
-	schedule_delayed_work(&priv->stats_poll, HZ);
+	/* The firmware may not have survived, config_init() checks it */
+	mutex_lock(&priv->lock);
+	if (priv->state == MXL371X_STATE_SUSPENDED)
+		mxl371x_set_state(priv, MXL371X_STATE_RECOVERING);
+	mutex_unlock(&priv->lock);
+
 	return genphy_resume(phydev);
 }
 
@@ -1216,7 +3791,17 @@ static struct phy_driver mxl371x_drivers[] = {
 		.config_init	= mxl371x_config_init,
 		.config_aneg	= mxl371x_config_aneg,
 		.read_status	= mxl371x_read_status,
+		.get_rate_matching = mxl371x_get_rate_matching,
+		.inband_caps	= mxl371x_inband_caps,
+		.config_inband	= mxl371x_config_inband,
 		.get_phy_stats	= mxl371x_get_phy_stats,
+		.get_link_stats	= mxl371x_get_link_stats,
+		.get_sset_count	= mxl371x_get_sset_count,
+		.get_strings	= mxl371x_get_strings,
+		.get_stats	= mxl371x_get_stats,
+		.set_loopback	= genphy_loopback,
+		.get_sqi	= mxl371x_get_sqi,
+		.get_sqi_max	= mxl371x_get_sqi_max,
 		.suspend	= mxl371x_suspend,
 		.resume		= mxl371x_resume,
 		.read_page	= mxl371x_read_page,
@@ -1229,7 +3814,17 @@ static struct phy_driver mxl371x_drivers[] = {
 		.config_init	= mxl371x_config_init,
 		.config_aneg	= mxl371x_config_aneg,
 		.read_status	= mxl371x_read_status,
+		.get_rate_matching = mxl371x_get_rate_matching,
+		.inband_caps	= mxl371x_inband_caps,
+		.config_inband	= mxl371x_config_inband,
 		.get_phy_stats	= mxl371x_get_phy_stats,
+		.get_link_stats	= mxl371x_get_link_stats,
+		.get_sset_count	= mxl371x_get_sset_count,
+		.get_strings	= mxl371x_get_strings,
+		.get_stats	= mxl371x_get_stats,
+		.set_loopback	= genphy_loopback,
+		.get_sqi	= mxl371x_get_sqi,
+		.get_sqi_max	= mxl371x_get_sqi_max,
 		.suspend	= mxl371x_suspend,
 		.resume		= mxl371x_resume,
 		.read_page	= mxl371x_read_page,
@@ -1242,7 +3837,17 @@ static struct phy_driver mxl371x_drivers[] = {
 		.config_init	= mxl371x_config_init,
 		.config_aneg	= mxl371x_config_aneg,
 		.read_status	= mxl371x_read_status,
+		.get_rate_matching = mxl371x_get_rate_matching,
+		.inband_caps	= mxl371x_inband_caps,
+		.config_inband	= mxl371x_config_inband,
 		.get_phy_stats	= mxl371x_get_phy_stats,
+		.get_link_stats	= mxl371x_get_link_stats,
+		.get_sset_count	= mxl371x_get_sset_count,
+		.get_strings	= mxl371x_get_strings,
+		.get_stats	= mxl371x_get_stats,
+		.set_loopback	= genphy_loopback,
+		.get_sqi	= mxl371x_get_sqi,
+		.get_sqi_max	= mxl371x_get_sqi_max,
 		.suspend	= mxl371x_suspend,
 		.resume		= mxl371x_resume,
 		.read_page	= mxl371x_read_page,
@@ -1250,7 +3855,27 @@ static struct phy_driver mxl371x_drivers[] = {
 	},
 };
 
-module_phy_driver(mxl371x_drivers);
+static int __init mxl371x_init(void)
+{
+	int ret;
+
+	mxl371x_debugfs_register();
+
+	ret = phy_drivers_register(mxl371x_drivers,
+				   ARRAY_SIZE(mxl371x_drivers), THIS_MODULE);
+	if (ret)
+		mxl371x_debugfs_unregister();
+
+	return ret;
+}
+module_init(mxl371x_init);
+
+static void __exit mxl371x_exit(void)
+{
+	phy_drivers_unregister(mxl371x_drivers, ARRAY_SIZE(mxl371x_drivers));
+	mxl371x_debugfs_unregister();
+}
+module_exit(mxl371x_exit);
 
 static const struct mdio_device_id __maybe_unused mxl371x_tbl[] = {
 	{ PHY_ID_MATCH_VENDOR(MXL371X_OUI) },